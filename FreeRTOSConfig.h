@@ -85,10 +85,15 @@ extern "C" {
  * FreeRTOS API DOCUMENTATION AVAILABLE ON THE FreeRTOS.org WEB SITE.
  *----------------------------------------------------------*/
 
+/* The fiber port switches tasks only where they yield or block, see portable/Fiber */
+#ifdef SOCSIM_FIBER_PORT
+#define configUSE_PREEMPTION					0
+#else
 #define configUSE_PREEMPTION					1
+#endif
 #define configUSE_PORT_OPTIMISED_TASK_SELECTION	0
-#define configUSE_IDLE_HOOK						0
-#define configUSE_TICK_HOOK						0
+#define configUSE_IDLE_HOOK						1	/* Deterministic runs step short idle times from it */
+#define configUSE_TICK_HOOK						1	/* The simulator uses it to interpolate time inside a tick */
 #define configTICK_RATE_HZ						( 1000 ) 
 #define configMINIMAL_STACK_SIZE				( ( unsigned short ) 50 ) /* In this simulated case, the stack only has to hold one small structure as the real stack is part of the win32 thread. */
 #define configTOTAL_HEAP_SIZE					( ( size_t ) ( 23 * 1024 ) )
@@ -124,6 +129,11 @@ extern void vPortFindTicksPerSecond( void );
 extern unsigned long ulPortGetTimerValue( void );
 #define portGET_RUN_TIME_COUNTER_VALUE() ulPortGetTimerValue()
 
+/* Tickless idle: the idle task sleeps until the next timeout or event, or jumps over idle time, see SoC_SuppressTicks() */
+#define configUSE_TICKLESS_IDLE					2
+extern void SoC_SuppressTicks( unsigned long ulExpectedIdleTime );
+#define portSUPPRESS_TICKS_AND_SLEEP( xExpectedIdleTime ) SoC_SuppressTicks( xExpectedIdleTime )
+
 /* Co-routine related configuration options. */
 #define configUSE_CO_ROUTINES 					1
 #define configMAX_CO_ROUTINE_PRIORITIES			( 2 )
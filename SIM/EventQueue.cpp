@@ -0,0 +1,754 @@
+/*!
+ \file EventQueue.cpp
+ \brief Discrete-event kernel for the peripheral models
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+
+#include "EventQueue.h"
+
+EventQueue events;
+
+/** The calling thread is a host thread, see EventQueue::set_host_thread() */
+static thread_local bool event_host_thread = false;
+
+/**
+ * @brief Host monotonic time
+ * @return nanoseconds
+ */
+static int64_t host_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Node slot while in the ready heap */
+#define NODE_READY (-1)
+
+/** Node slot while free */
+#define NODE_FREE (-2)
+
+/** Node slot while cancelled in the ready heap, it is freed when it reaches the top */
+#define NODE_CANCELLED (-3)
+
+/**
+ * @brief Ready heap order, the earliest event on top
+ */
+struct ReadyLater {
+    const std::vector<Event> &nodes;
+
+    bool operator()(int a, int b) const {
+        if (nodes[a].when != nodes[b].when) {
+            return nodes[a].when > nodes[b].when;
+        }
+        return nodes[a].seq > nodes[b].seq;
+    }
+};
+
+/**
+ * @brief Mixes the post order with the seed, to shuffle events at the same time
+ * @param x post order xor seed
+ */
+static uint64_t seq_mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief Tick an event belongs to, it runs in this tick once its time is reached
+ * @param when virtual time in ns
+ */
+static uint64_t event_tick(uint64_t when) {
+    return when / EVENT_NS_PER_TICK;
+}
+
+/**
+ * @brief First tick of the block of ticks covered by a wheel level
+ * @param tick wheel time
+ * @param level wheel level
+ */
+static uint64_t level_base(uint64_t tick, int level) {
+    int shift = EVENT_WHEEL_BITS * (level + 1);
+
+    return (shift >= 64) ? 0 : (tick >> shift) << shift;
+}
+
+EventQueue::EventQueue() : nodes(), free_nodes(-1), slots(), slot_bits(), level_bits(0), wheel_tick(0), ready(),
+                           task(nullptr), next_seq(0), last_ticks(0), sim_speed(1.0), skipped_ticks(0),
+                           tick_start(0), tick_scale(1.0), idle_mutex(), idle_wake(), idle_sleeping(false),
+                           determ(false), seed(0), next_input_seq(0), input_kinds(), inputs(nullptr), record(nullptr),
+                           replay(nullptr), idle_stepped(false) {
+    for (auto &level : slots) {
+        level.fill(-1);
+    }
+}
+
+void EventQueue::start() {
+    tick_start.store(host_ns(), std::memory_order_relaxed);
+    if (replay != nullptr) {
+        load_replay();
+    }
+    xTaskCreate(task_loop, "EVT", 10000, this, configMAX_PRIORITIES - 1, &task);
+}
+
+uint64_t EventQueue::ticks() {
+    uint64_t last = last_ticks.load(std::memory_order_relaxed);
+    TickType_t delta = xTaskGetTickCount() - (TickType_t) last;
+    uint64_t cur = last + delta;
+
+    /* The 64 bit count only moves forward, a failed exchange means another task already moved it */
+    if (cur > last) {
+        last_ticks.compare_exchange_strong(last, cur, std::memory_order_relaxed);
+    }
+    return cur;
+}
+
+uint64_t EventQueue::now() {
+    /* Deterministic runs spend no virtual time out of idle */
+    if (determ) {
+        return ticks() * EVENT_NS_PER_TICK;
+    }
+
+    int64_t elapsed = host_ns() - tick_start.load(std::memory_order_relaxed);
+    uint64_t sub_tick = 0;
+
+    /* Never reaches the next tick, so time does not go back when it comes */
+    if (elapsed > 0) {
+        sub_tick = std::min<uint64_t>(elapsed * tick_scale.load(std::memory_order_relaxed), EVENT_NS_PER_TICK - 1);
+    }
+    return ticks() * EVENT_NS_PER_TICK + sub_tick;
+}
+
+void EventQueue::tick_hook() {
+    tick_start.store(host_ns(), std::memory_order_relaxed);
+
+    /* Host threads do not call the kernel, their inputs wait for the tick */
+    if ((inputs.load(std::memory_order_relaxed) != nullptr) && (task != nullptr)) {
+        vTaskNotifyGiveFromISR(task, nullptr);
+    }
+}
+
+uint64_t EventQueue::host_now() const {
+    return last_ticks.load(std::memory_order_relaxed) * EVENT_NS_PER_TICK;
+}
+
+int EventQueue::post_at(uint64_t when, event_func cb, uint32_t param) {
+    return post(when, cb, param, false);
+}
+
+int EventQueue::post(uint64_t when, event_func cb, uint32_t param, bool host_input) {
+    bool first;
+    int id;
+
+    {
+        EventLock lock;
+        uint64_t before = next_locked();
+        int node = alloc_node();
+        Event &e = nodes[node];
+
+        /* The id of a reused node changes in the bits above the node index */
+        id = ((((e.id >> EVENT_ID_NODE_BITS) + 1) & ((1 << (31 - EVENT_ID_NODE_BITS)) - 1))
+              << EVENT_ID_NODE_BITS) | node;
+        e.when = when;
+        if (host_input) {
+            e.seq = next_input_seq++;
+        } else {
+            e.seq = EVENT_SEQ_EVENTS | ((seed != 0) ? seq_mix(next_seq++ ^ seed) >> 1 : next_seq++);
+        }
+        e.cb = cb;
+        e.param = param;
+        e.id = id;
+        insert(node);
+        first = (when < before);
+    }
+
+    /* The event task sleeps until the previous first event, wake it up earlier */
+    if (first && (task != nullptr)) {
+        xTaskNotifyGive(task);
+    }
+    return id;
+}
+
+int EventQueue::post_in(uint64_t delay, event_func cb, uint32_t param) {
+    return post_at(now() + delay, cb, param);
+}
+
+int EventQueue::post_now(event_func cb, uint32_t param) {
+    return post_at(0, cb, param);
+}
+
+void EventQueue::add_input(const char *name, event_func cb) {
+    input_kinds.push_back({name, cb});
+}
+
+const char *EventQueue::input_name(event_func cb) const {
+    for (const auto &kind : input_kinds) {
+        if (kind.cb == cb) {
+            return kind.name;
+        }
+    }
+    return nullptr;
+}
+
+void EventQueue::input(event_func cb, uint32_t param) {
+    /* A replay only applies the inputs of its file */
+    if (replay != nullptr) {
+        return;
+    }
+
+    push_input(new HostInput{cb, param, false, nullptr});
+}
+
+void EventQueue::host_call(event_func cb, uint32_t param) {
+    push_input(new HostInput{cb, param, true, nullptr});
+}
+
+bool EventQueue::event_task() const {
+    return (task != nullptr) && (xTaskGetCurrentTaskHandle() == task);
+}
+
+void EventQueue::push_input(HostInput *in) {
+    in->next = inputs.load(std::memory_order_relaxed);
+    while (!inputs.compare_exchange_weak(in->next, in, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+
+    /* The tick wakes the event task up, a paced idle sleep has stopped it */
+    std::lock_guard<std::mutex> lock(idle_mutex);
+    if (idle_sleeping) {
+        idle_sleeping = false;
+        idle_wake.notify_one();
+    }
+}
+
+void EventQueue::set_host_thread() {
+    event_host_thread = true;
+}
+
+bool EventQueue::host_thread() {
+    return event_host_thread;
+}
+
+void EventQueue::set_deterministic(uint64_t p_seed, const char *record_file, const char *replay_file) {
+    determ = true;
+    seed = p_seed;
+    replay = replay_file;
+
+    if (record_file != nullptr) {
+        record = fopen(record_file, "w");
+        if (record == nullptr) {
+            printf("Cannot write inputs to %s\n", record_file);
+        } else {
+            fprintf(record, "# SoCSIM inputs: tick name param\n");
+        }
+    }
+}
+
+bool EventQueue::deterministic() const {
+    return determ;
+}
+
+void EventQueue::take_inputs() {
+    HostInput *in = inputs.exchange(nullptr, std::memory_order_acquire);
+    HostInput *first = nullptr;
+
+    if (in == nullptr) {
+        return;
+    }
+
+    /* The list holds the last input first */
+    while (in != nullptr) {
+        HostInput *next = in->next;
+
+        in->next = first;
+        first = in;
+        in = next;
+    }
+
+    /* The firmware may be anywhere in the current tick, the next one is the same in a replay */
+    uint64_t tick = ticks() + 1;
+    for (in = first; in != nullptr; in = first) {
+        first = in->next;
+        if (!determ || in->control) {
+            in->cb(in->param);
+        } else {
+            post(tick * EVENT_NS_PER_TICK, in->cb, in->param, true);
+            if (record != nullptr) {
+                fprintf(record, "%llu %s %u\n", (unsigned long long) tick, input_name(in->cb), in->param);
+            }
+        }
+        delete in;
+    }
+    if (record != nullptr) {
+        fflush(record);
+    }
+}
+
+void EventQueue::load_replay() {
+    FILE *file = fopen(replay, "r");
+    char line[128];
+    int count = 0;
+
+    if (file == nullptr) {
+        printf("Cannot read inputs from %s\n", replay);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        unsigned long long tick;
+        unsigned long param;
+        char name[32];
+        event_func cb = nullptr;
+
+        if ((line[0] == '#') || (sscanf(line, "%llu %31s %lu", &tick, name, &param) != 3)) {
+            continue;
+        }
+        for (const auto &kind : input_kinds) {
+            if (strcmp(kind.name, name) == 0) {
+                cb = kind.cb;
+            }
+        }
+        if (cb == nullptr) {
+            printf("Unknown input %s in %s\n", name, replay);
+            continue;
+        }
+        post(tick * EVENT_NS_PER_TICK, cb, (uint32_t) param, true);
+        count++;
+    }
+    fclose(file);
+    printf("Replaying %d inputs from %s\n", count, replay);
+}
+
+bool EventQueue::cancel(int id) {
+    EventLock lock;
+    int node = id & ((1 << EVENT_ID_NODE_BITS) - 1);
+
+    if ((id < 0) || (node >= (int) nodes.size()) || (nodes[node].id != id) || (nodes[node].slot == NODE_FREE) ||
+        (nodes[node].slot == NODE_CANCELLED)) {
+        return false;
+    }
+
+    /* Removing a node from inside the heap would need a search, it is skipped when popped instead */
+    if (nodes[node].slot == NODE_READY) {
+        nodes[node].slot = NODE_CANCELLED;
+        drop_cancelled();
+        return true;
+    }
+    unlink(node);
+    free_node(node);
+    return true;
+}
+
+uint64_t EventQueue::next() {
+    EventLock lock;
+
+    return next_locked();
+}
+
+int EventQueue::alloc_node() {
+    int node = free_nodes;
+
+    if (node < 0) {
+        if (nodes.size() >= (1U << EVENT_ID_NODE_BITS)) {
+            printf("Event queue full: %zu pending events\n", nodes.size());
+            abort();
+        }
+        nodes.push_back({0, 0, nullptr, 0, -1, -1, -1, NODE_FREE});
+        return (int) nodes.size() - 1;
+    }
+    free_nodes = nodes[node].next;
+    return node;
+}
+
+void EventQueue::free_node(int node) {
+    nodes[node].slot = NODE_FREE;
+    nodes[node].next = free_nodes;
+    free_nodes = node;
+}
+
+void EventQueue::insert(int node) {
+    Event &e = nodes[node];
+    uint64_t tick = event_tick(e.when);
+
+    if (tick <= wheel_tick) {
+        e.slot = NODE_READY;
+        ready.push_back(node);
+        std::push_heap(ready.begin(), ready.end(), ReadyLater{nodes});
+        return;
+    }
+
+    /* The highest group of bits that differs from the wheel time is larger in the tick: the slot is ahead */
+    int level = (63 - __builtin_clzll(tick ^ wheel_tick)) / EVENT_WHEEL_BITS;
+    int index = (int) (tick >> (level * EVENT_WHEEL_BITS)) & (EVENT_WHEEL_SLOTS - 1);
+    int &head = slots[level][index];
+
+    e.slot = level * EVENT_WHEEL_SLOTS + index;
+    e.prev = -1;
+    e.next = head;
+    if (head >= 0) {
+        nodes[head].prev = node;
+    }
+    head = node;
+    slot_bits[level] |= 1ULL << index;
+    level_bits |= 1U << level;
+}
+
+void EventQueue::drop_cancelled() {
+    while (!ready.empty() && (nodes[ready.front()].slot == NODE_CANCELLED)) {
+        std::pop_heap(ready.begin(), ready.end(), ReadyLater{nodes});
+        free_node(ready.back());
+        ready.pop_back();
+    }
+}
+
+void EventQueue::unlink(int node) {
+    Event &e = nodes[node];
+    int level = e.slot / EVENT_WHEEL_SLOTS;
+    int index = e.slot % EVENT_WHEEL_SLOTS;
+
+    if (e.prev >= 0) {
+        nodes[e.prev].next = e.next;
+    } else {
+        slots[level][index] = e.next;
+    }
+    if (e.next >= 0) {
+        nodes[e.next].prev = e.prev;
+    }
+    if (slots[level][index] < 0) {
+        slot_bits[level] &= ~(1ULL << index);
+        if (slot_bits[level] == 0) {
+            level_bits &= ~(1U << level);
+        }
+    }
+}
+
+void EventQueue::advance(uint64_t tick) {
+    /*
+     * Occupied slots are ahead of the wheel time on their level and the lowest
+     * occupied level has the earliest one, so the wheel jumps from slot to slot.
+     */
+    while (level_bits != 0) {
+        int level = __builtin_ctz(level_bits);
+        int index = __builtin_ctzll(slot_bits[level]);
+        uint64_t start = level_base(wheel_tick, level) | ((uint64_t) index << (level * EVENT_WHEEL_BITS));
+
+        if (start > tick) {
+            break;
+        }
+        wheel_tick = start;
+
+        int node = slots[level][index];
+        slots[level][index] = -1;
+        slot_bits[level] &= ~(1ULL << index);
+        if (slot_bits[level] == 0) {
+            level_bits &= ~(1U << level);
+        }
+        /* Cascade: the events of the slot go down a level or to the ready heap */
+        while (node >= 0) {
+            int next = nodes[node].next;
+
+            insert(node);
+            node = next;
+        }
+    }
+    if (tick > wheel_tick) {
+        wheel_tick = tick;
+    }
+}
+
+uint64_t EventQueue::next_locked() const {
+    if (!ready.empty()) {
+        return nodes[ready.front()].when;
+    }
+    if (level_bits == 0) {
+        return EVENT_NEVER;
+    }
+
+    int level = __builtin_ctz(level_bits);
+    int index = __builtin_ctzll(slot_bits[level]);
+
+    return (level_base(wheel_tick, level) | ((uint64_t) index << (level * EVENT_WHEEL_BITS))) * EVENT_NS_PER_TICK;
+}
+
+void EventQueue::set_speed(double speed) {
+    if (speed != EVENT_SPEED_AFAP) {
+        speed = std::clamp(speed, EVENT_SPEED_MIN, EVENT_SPEED_MAX);
+    }
+    sim_speed.store(speed, std::memory_order_relaxed);
+
+    /* While the idle task paces idle time the timer is stopped, it restarts it with the new speed */
+    bool clamped;
+    if (tick_timer_running()) {
+        set_tick_timer(tick_period_us(&clamped));
+    }
+
+    std::lock_guard<std::mutex> lock(idle_mutex);
+    if (idle_sleeping) {
+        idle_sleeping = false;
+        idle_wake.notify_one();
+    }
+}
+
+double EventQueue::speed() const {
+    return sim_speed.load(std::memory_order_relaxed);
+}
+
+uint64_t EventQueue::tick_period_us(bool *clamped) const {
+    double speed = sim_speed.load(std::memory_order_relaxed);
+    double period = (speed == EVENT_SPEED_AFAP) ? 0.0 : (EVENT_NS_PER_TICK / 1000.0) / speed;
+
+    *clamped = (period < EVENT_TICK_MIN_US);
+    return *clamped ? EVENT_TICK_MIN_US : (uint64_t) period;
+}
+
+bool EventQueue::tick_timer_running() {
+    struct itimerval timer = {};
+
+    return (getitimer(ITIMER_REAL, &timer) == 0) &&
+           ((timer.it_interval.tv_sec != 0) || (timer.it_interval.tv_usec != 0));
+}
+
+void EventQueue::set_tick_timer(uint64_t period_us, uint64_t first_us) {
+    struct itimerval timer = {};
+
+    if (period_us != 0) {
+        tick_scale.store((double) EVENT_NS_PER_TICK / (period_us * 1000), std::memory_order_relaxed);
+    }
+
+    timer.it_interval.tv_sec = period_us / 1000000;
+    timer.it_interval.tv_usec = period_us % 1000000;
+    if (first_us == 0) {
+        timer.it_value = timer.it_interval;
+    } else {
+        timer.it_value.tv_sec = first_us / 1000000;
+        timer.it_value.tv_usec = first_us % 1000000;
+    }
+    setitimer(ITIMER_REAL, &timer, nullptr);
+}
+
+TickType_t EventQueue::pace_idle(TickType_t expected_idle, bool until_woken, uint64_t *phase) {
+    double speed = sim_speed.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(idle_mutex);
+
+    if (until_woken || (speed == EVENT_SPEED_AFAP)) {
+        idle_wake.wait(lock, [this] { return !idle_sleeping; });
+    } else {
+        auto idle_time = std::chrono::nanoseconds((uint64_t) (expected_idle * (EVENT_NS_PER_TICK / speed)));
+        idle_wake.wait_until(lock, start + idle_time, [this] { return !idle_sleeping; });
+    }
+    idle_sleeping = false;
+
+    /* As fast as possible only sleeps when nothing is pending, the virtual time does not move */
+    *phase = 0;
+    if (speed == EVENT_SPEED_AFAP) {
+        return 0;
+    }
+
+    auto slept = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    uint64_t virtual_ns = (uint64_t) (slept.count() * speed);
+    uint64_t slept_ticks = virtual_ns / EVENT_NS_PER_TICK;
+
+    /* Never step onto the next timeout, the tick timer brings it right away */
+    if (slept_ticks >= expected_idle) {
+        *phase = EVENT_NS_PER_TICK - 1;
+        return expected_idle - 1;
+    }
+    *phase = virtual_ns % EVENT_NS_PER_TICK;
+    return (TickType_t) slept_ticks;
+}
+
+BaseType_t EventQueue::add_tick() {
+    BaseType_t switch_required;
+
+    /* Like the tick interrupt, with the scheduler suspended the kernel counts it when it resumes */
+    taskENTER_CRITICAL();
+    switch_required = xTaskIncrementTick();
+    taskEXIT_CRITICAL();
+    return switch_required;
+}
+
+TickType_t EventQueue::step_idle(TickType_t expected_idle, bool until_woken, bool fast,
+                                 BaseType_t *switch_required) {
+    double speed = sim_speed.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    bool woken = false;
+
+    {
+        std::unique_lock<std::mutex> lock(idle_mutex);
+
+        if (until_woken) {
+            idle_wake.wait(lock, [this] { return !idle_sleeping; });
+            woken = true;
+        } else if (!fast && (speed != EVENT_SPEED_AFAP)) {
+            auto idle_time = std::chrono::nanoseconds((uint64_t) (expected_idle * (EVENT_NS_PER_TICK / speed)));
+            woken = idle_wake.wait_until(lock, start + idle_time, [this] { return !idle_sleeping; });
+        }
+        idle_sleeping = false;
+    }
+
+    /* Woken up by an input, only the ticks slept are stepped, the input time is recorded */
+    if (woken) {
+        TickType_t slept = 0;
+
+        if (!until_woken) {
+            auto host = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            slept = (TickType_t) std::min<uint64_t>((uint64_t) (host.count() * speed) / EVENT_NS_PER_TICK,
+                                                    expected_idle - 1);
+        }
+        if (slept > 0) {
+            vTaskStepTick(slept);
+            skipped_ticks.fetch_add(slept, std::memory_order_relaxed);
+        }
+        return slept;
+    }
+
+    /* Stepping onto the timeout would leave the task blocked, the last tick is a real one */
+    if (expected_idle > 1) {
+        vTaskStepTick(expected_idle - 1);
+    }
+    skipped_ticks.fetch_add(expected_idle, std::memory_order_relaxed);
+    BaseType_t required = add_tick();
+    if (switch_required != nullptr) {
+        *switch_required = required;
+    }
+    return expected_idle;
+}
+
+TickType_t EventQueue::idle_hook(bool fast_forward) {
+    if (!determ) {
+        return 0;
+    }
+
+    /* The idle task only sleeps for two ticks or more, shorter idle times are stepped here */
+    if (idle_stepped) {
+        idle_stepped = false;
+        return 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        idle_sleeping = true;
+    }
+    BaseType_t switch_required = pdFALSE;
+    TickType_t stepped = step_idle(1, false, fast_forward, &switch_required);
+    if (switch_required != pdFALSE) {
+        taskYIELD();
+    }
+    return stepped;
+}
+
+TickType_t EventQueue::idle(TickType_t expected_idle, bool fast_forward) {
+    bool clamped;
+    uint64_t phase;
+
+    idle_stepped = true;
+
+    /* The port arms the tick timer when the scheduler starts, deterministic runs do not use it */
+    if (!determ && !tick_timer_running()) {
+        return 0;
+    }
+
+    /* From here an input from a host thread cancels the sleep, even if it comes before the wait */
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        idle_sleeping = true;
+    }
+
+    /* An input queued before waits for the next tick, do not sleep over it */
+    eSleepModeStatus status = eTaskConfirmSleepModeStatus();
+    if ((status == eAbortSleep) || (inputs.load(std::memory_order_acquire) != nullptr)) {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        idle_sleeping = false;
+        return 0;
+    }
+
+    if (determ) {
+        return step_idle(expected_idle, status == eNoTasksWaitingTimeout, fast_forward);
+    }
+
+    /* The event task waits for the next event, so it is already one of the timeouts */
+    if ((fast_forward || (sim_speed.load(std::memory_order_relaxed) == EVENT_SPEED_AFAP)) &&
+        (status != eNoTasksWaitingTimeout)) {
+        TickType_t stepped = step_idle(expected_idle, false, true);
+        tick_start.store(host_ns(), std::memory_order_relaxed);
+        return stepped;
+    }
+
+    /* Stop the tick and sleep until the next timeout, or an input from the GUI or the UART */
+    set_tick_timer(0);
+    TickType_t slept = pace_idle(expected_idle, status == eNoTasksWaitingTimeout, &phase);
+    if (slept > 0) {
+        vTaskStepTick(slept);
+    }
+
+    /* The next tick comes when the current one would have ended, so idle time does not drift */
+    uint64_t period_us = tick_period_us(&clamped);
+    uint64_t first_us = std::max<uint64_t>(period_us * (EVENT_NS_PER_TICK - phase) / EVENT_NS_PER_TICK, 1);
+    set_tick_timer(period_us, first_us);
+    tick_start.store(host_ns() - (int64_t) (phase / tick_scale.load(std::memory_order_relaxed)),
+                     std::memory_order_relaxed);
+    return slept;
+}
+
+uint64_t EventQueue::skipped() const {
+    return skipped_ticks.load(std::memory_order_relaxed) * EVENT_NS_PER_TICK;
+}
+
+void EventQueue::run_due() {
+    uint64_t time = now();
+
+    while (true) {
+        Event e;
+        {
+            EventLock lock;
+
+            advance(event_tick(time));
+            if (ready.empty() || (nodes[ready.front()].when > time)) {
+                return;
+            }
+            std::pop_heap(ready.begin(), ready.end(), ReadyLater{nodes});
+            int node = ready.back();
+            ready.pop_back();
+            e = nodes[node];
+            free_node(node);
+            drop_cancelled();
+        }
+        /* Handlers run unlocked, they usually post their next event */
+        e.cb(e.param);
+    }
+}
+
+[[noreturn]] void EventQueue::task_loop(void *parameters) {
+    auto *queue = static_cast<EventQueue *>(parameters);
+    bool clamped;
+
+    /* The port has armed the tick timer when the first task runs, deterministic runs stop it */
+    if (tick_timer_running()) {
+        queue->set_tick_timer(queue->determ ? 0 : queue->tick_period_us(&clamped));
+    }
+
+    while (true) {
+        queue->take_inputs();
+        queue->run_due();
+
+        uint64_t when = queue->next();
+        TickType_t wait = portMAX_DELAY;
+
+        if (when != EVENT_NEVER) {
+            uint64_t tick = (when + EVENT_NS_PER_TICK - 1) / EVENT_NS_PER_TICK;
+            uint64_t cur = queue->ticks();
+
+            wait = (tick > cur) ? (TickType_t) std::min<uint64_t>(tick - cur, portMAX_DELAY - 1) : 0;
+        }
+        if (wait != 0) {
+            ulTaskNotifyTake(pdTRUE, wait);
+        }
+    }
+}
@@ -0,0 +1,569 @@
+/*!
+ \file EventQueue.h
+ \brief Discrete-event kernel for the peripheral models
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef SIM_EVENTQUEUE_H_
+#define SIM_EVENTQUEUE_H_
+
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+/** Virtual nanoseconds per FreeRTOS tick */
+#define EVENT_NS_PER_TICK (1000000000ULL / configTICK_RATE_HZ)
+
+/** Virtual nanoseconds per millisecond */
+#define EVENT_NS_PER_MS (1000000ULL)
+
+/** Time of the next event when the queue is empty */
+#define EVENT_NEVER (UINT64_MAX)
+
+/** Slowest simulation speed */
+#define EVENT_SPEED_MIN (0.01)
+
+/** Fastest paced simulation speed */
+#define EVENT_SPEED_MAX (1000.0)
+
+/** Speed to run as fast as possible */
+#define EVENT_SPEED_AFAP (0.0)
+
+/** Shortest host tick period, in us: faster speeds only apply to idle time */
+#define EVENT_TICK_MIN_US (50)
+
+/** Bits of the tick count per timing wheel level */
+#define EVENT_WHEEL_BITS (6)
+
+/** Slots per timing wheel level */
+#define EVENT_WHEEL_SLOTS (1 << EVENT_WHEEL_BITS)
+
+/** Timing wheel levels, enough to cover a 64 bit tick count */
+#define EVENT_WHEEL_LEVELS ((64 + EVENT_WHEEL_BITS - 1) / EVENT_WHEEL_BITS)
+
+/** Bits of an event id that select its node, the rest tell reused nodes apart */
+#define EVENT_ID_NODE_BITS (20)
+
+/** Post order of the events that are not host inputs, inputs run first among events at the same time */
+#define EVENT_SEQ_EVENTS (1ULL << 63)
+
+/**
+ * @brief Event handler
+ * @param param parameter given when the event was posted
+ */
+typedef void (*event_func)(uint32_t param);
+
+/**
+ * @brief Kind of host input that deterministic runs record and replay
+ */
+struct EventInput {
+    const char *name;   /**< name in the input file */
+    event_func cb;      /**< handler, applies the input */
+};
+
+/**
+ * @brief Host input waiting for the event task, a node of a lock-free list
+ */
+struct HostInput {
+    event_func cb;      /**< handler registered with EventQueue::add_input() */
+    uint32_t param;     /**< handler parameter */
+    bool control;       /**< queued by EventQueue::host_call(), not part of the simulation */
+    HostInput *next;    /**< input queued before this one */
+};
+
+/**
+ * @brief Pending event, a node of the timing wheel
+ */
+struct Event {
+    uint64_t when;      /**< virtual time in ns */
+    uint64_t seq;       /**< post order, events at the same time run in this order */
+    event_func cb;      /**< handler */
+    uint32_t param;     /**< handler parameter */
+    int id;             /**< id returned by post_at(), kept while the node is free so its next id differs */
+    int prev;           /**< previous node in the slot list, -1 for the first one */
+    int next;           /**< next node in the slot list or in the free list, -1 for the last one */
+    int slot;           /**< level * EVENT_WHEEL_SLOTS + slot, -1 while in the ready heap, -2 while free,
+                             -3 while cancelled in the ready heap */
+};
+
+/**
+ * @brief Timed events of the peripheral models on a virtual clock
+ *
+ * The virtual clock is the FreeRTOS tick count, so peripherals and firmware
+ * delays share the same time base. Inside a tick it is interpolated from the
+ * host clock, so counters can be read with sub-tick resolution. Events run in
+ * order on a single FreeRTOS task of the highest priority, like interrupts.
+ *
+ * Pending events are kept in a hierarchical timing wheel indexed by tick,
+ * so posting and cancelling take constant time however many events are
+ * pending. An event goes to the level of the highest group of
+ * #EVENT_WHEEL_BITS bits where its tick differs from the wheel time, in the
+ * slot given by that group. When the wheel time reaches a slot, its events
+ * move down to the lower levels or, in their tick, to a small ready heap that
+ * runs them in (time, post order). Empty slots are found with one bitmap per
+ * level, so the wheel jumps over idle time without visiting every tick.
+ *
+ * The simulation speed scales the period of the host timer that generates
+ * the ticks, so firmware, RTC, DAC, watchdog and UART keep their relative
+ * timing. Above 1 / #EVENT_TICK_MIN_US MHz of ticks the timer stays at its
+ * shortest period, which only slows down busy time. Idle is tickless at any
+ * speed: the idle task stops the timer, sleeps the scaled time to the next
+ * timeout or event and steps the tick count (see SoC_SuppressTicks()), so an
+ * idle simulator does not wake up the host. As fast as possible steps over
+ * idle time without sleeping.
+ *
+ * In deterministic mode the host clock no longer drives the tick: virtual
+ * time only moves while the firmware is idle, by whole ticks, to the next
+ * timeout or event, and the host clock just paces it. Host inputs (GUI, UART)
+ * are not applied when they come but at the start of the tick after the event
+ * task takes them, before the other events of that tick. They can be recorded
+ * to a file and replayed at the same ticks, and a seed can shuffle the order
+ * of events at the same time, so runs repeat exactly.
+ *
+ * Locking rules. The wheel and the ready heap are only used by FreeRTOS
+ * tasks, which exclude each other by suspending the scheduler. A host mutex
+ * would deadlock there: the Linux port can stop a task that holds it and run
+ * the event task, which then waits for it forever. Host threads (GUI, UART)
+ * never take that path nor call the kernel, set_host_thread() tells them
+ * apart for the code both may run. They only use input() and host_call(),
+ * which push onto a lock-free list, and the tick hook wakes the event task up to
+ * take it. They may also read host_now(), speed() and change set_speed(),
+ * and the peripheral state published in a HostCopy.
+ * Event handlers run on the event task with nothing held.
+ */
+class EventQueue {
+public:
+    EventQueue();
+
+    /**
+     * @brief Creates the task that runs the events, before starting the scheduler
+     */
+    void start();
+
+    /**
+     * @brief Current virtual time, interpolated inside the current tick
+     * @return nanoseconds since the scheduler started
+     */
+    uint64_t now();
+
+    /**
+     * @brief Current virtual time in ticks, without wrap-around
+     */
+    uint64_t ticks();
+
+    /**
+     * @brief Virtual time for host threads (GUI), updated when the event task runs
+     * @return nanoseconds since the scheduler started
+     */
+    uint64_t host_now() const;
+
+    /**
+     * @brief Schedules an event at an absolute virtual time
+     * @param when virtual time in ns, times in the past run as soon as possible
+     * @param cb handler
+     * @param param handler parameter
+     * @return event id for cancel()
+     */
+    int post_at(uint64_t when, event_func cb, uint32_t param = 0);
+
+    /**
+     * @brief Schedules an event relative to the current virtual time
+     * @param delay delay in ns
+     * @param cb handler
+     * @param param handler parameter
+     * @return event id for cancel()
+     */
+    int post_in(uint64_t delay, event_func cb, uint32_t param = 0);
+
+    /**
+     * @brief Schedules an event as soon as possible, from a task
+     * @param cb handler
+     * @param param handler parameter
+     * @return event id for cancel()
+     */
+    int post_now(event_func cb, uint32_t param = 0);
+
+    /**
+     * @brief Registers a kind of host input, before start()
+     * @param name name in the input files, without spaces
+     * @param cb handler, applies the input from its parameter
+     */
+    void add_input(const char *name, event_func cb);
+
+    /**
+     * @brief Applies an input from a host thread (GUI, UART)
+     *
+     * Queues the input without locks and ends a paced idle sleep. The event
+     * task takes it at the next tick and runs the handler, or in
+     * deterministic mode posts it at the tick after that. Inputs are dropped
+     * while replaying an input file.
+     * @param cb handler registered with add_input()
+     * @param param handler parameter
+     */
+    void input(event_func cb, uint32_t param);
+
+    /**
+     * @brief Runs a simulator control from a host thread (GUI) on the event task
+     *
+     * Queued like input(), but not part of the simulation: the event task
+     * runs the handler as soon as it takes it, also in deterministic mode and
+     * while replaying, and it is never recorded.
+     * @param cb handler
+     * @param param handler parameter
+     */
+    void host_call(event_func cb, uint32_t param = 0);
+
+    /**
+     * @brief Checks if the caller is the event task
+     */
+    bool event_task() const;
+
+    /**
+     * @brief Marks the calling thread as a host thread, first thing it does
+     */
+    static void set_host_thread();
+
+    /**
+     * @brief Whether the calling thread is a host thread
+     * @return true if it called set_host_thread(), false on the FreeRTOS tasks
+     */
+    static bool host_thread();
+
+    /**
+     * @brief Makes the simulation deterministic, before start()
+     * @param seed 0 to run events at the same time in post order, else the seed of their order
+     * @param record_file file to write the host inputs to, nullptr for none
+     * @param replay_file file to read the host inputs from instead of the GUI and the UART, nullptr for none
+     */
+    void set_deterministic(uint64_t seed, const char *record_file, const char *replay_file);
+
+    /**
+     * @brief Checks if the simulation is deterministic
+     */
+    bool deterministic() const;
+
+    /**
+     * @brief Removes a pending event
+     * @param id event id
+     * @return true if the event was pending
+     */
+    bool cancel(int id);
+
+    /**
+     * @brief Virtual time of the next event, #EVENT_NEVER if there are none
+     */
+    uint64_t next();
+
+    /**
+     * @brief Sets the simulation speed
+     * @param speed virtual seconds per host second, clamped to #EVENT_SPEED_MIN .. #EVENT_SPEED_MAX,
+     * #EVENT_SPEED_AFAP to run as fast as possible
+     */
+    void set_speed(double speed);
+
+    /**
+     * @brief Current simulation speed, #EVENT_SPEED_AFAP when running as fast as possible
+     */
+    double speed() const;
+
+    /**
+     * @brief Sleeps through or skips idle time, called by the idle task with the scheduler suspended
+     * @param expected_idle ticks until the next task timeout
+     * @param fast_forward skip the time to the next timeout or event whatever the speed, as in a sleep mode
+     * @return ticks stepped over
+     */
+    TickType_t idle(TickType_t expected_idle, bool fast_forward = false);
+
+    /**
+     * @brief Moves a deterministic simulation one tick forward when the idle task cannot sleep
+     *
+     * Called by the FreeRTOS idle hook. Does nothing if the previous idle()
+     * stepped the time or if the simulation is not deterministic.
+     * @param fast_forward step without sleeping the scaled time, as in a sleep mode
+     * @return ticks stepped over
+     */
+    TickType_t idle_hook(bool fast_forward = false);
+
+    /**
+     * @brief Virtual time skipped while idle, in ns
+     */
+    uint64_t skipped() const;
+
+    /**
+     * @brief Marks the start of a tick and wakes the event task up for host inputs, called by the FreeRTOS tick hook
+     */
+    void tick_hook();
+
+    /**
+     * @brief Runs the events that are due, called by the event task
+     */
+    void run_due();
+
+private:
+    /**
+     * @brief Schedules an event
+     * @param when virtual time in ns
+     * @param cb handler
+     * @param param handler parameter
+     * @param host_input true to run it before the events that are not host inputs at the same time
+     * @return event id for cancel()
+     */
+    int post(uint64_t when, event_func cb, uint32_t param, bool host_input);
+
+    /**
+     * @brief Applies the host inputs queued since the last call, from the event task
+     *
+     * Runs their handlers, or in deterministic mode schedules them at the next tick.
+     */
+    void take_inputs();
+
+    /**
+     * @brief Pushes a host input onto the lock-free list and ends a paced idle sleep
+     * @param in input allocated by the host thread, the event task frees it
+     */
+    void push_input(HostInput *in);
+
+    /**
+     * @brief Posts the inputs of the replay file
+     */
+    void load_replay();
+
+    /**
+     * @brief Name of a kind of host input
+     * @param cb handler
+     * @return name, nullptr if cb is not registered
+     */
+    const char *input_name(event_func cb) const;
+
+    /**
+     * @brief Takes a node from the free list, scheduler suspended
+     * @return node index
+     */
+    int alloc_node();
+
+    /**
+     * @brief Returns a node to the free list, scheduler suspended
+     * @param node node index
+     */
+    void free_node(int node);
+
+    /**
+     * @brief Adds a node to its wheel slot, or to the ready heap if its tick is reached, scheduler suspended
+     * @param node node index
+     */
+    void insert(int node);
+
+    /**
+     * @brief Removes a node from its wheel slot, scheduler suspended
+     * @param node node index
+     */
+    void unlink(int node);
+
+    /**
+     * @brief Frees the cancelled nodes on top of the ready heap, scheduler suspended
+     *
+     * Cancelled nodes stay in the heap until they reach the top, so the top
+     * is always a pending event.
+     */
+    void drop_cancelled();
+
+    /**
+     * @brief Moves the wheel time forward, the events of the ticks reached go to the ready heap, scheduler suspended
+     * @param tick new wheel time
+     */
+    void advance(uint64_t tick);
+
+    /**
+     * @brief Time of the next event, scheduler suspended
+     *
+     * Exact for events in the ready heap, else the first tick of the first
+     * occupied slot, where the event task moves its events down.
+     * @return virtual time in ns, #EVENT_NEVER if there are no events
+     */
+    uint64_t next_locked() const;
+
+    /**
+     * @brief Host tick period for the current speed
+     * @param clamped set to true if the speed needs a shorter period than #EVENT_TICK_MIN_US
+     * @return period in us
+     */
+    uint64_t tick_period_us(bool *clamped) const;
+
+    /**
+     * @brief Checks if the host tick timer runs
+     *
+     * The Linux port generates the ticks with ITIMER_REAL, it is left alone
+     * until the port arms it.
+     */
+    static bool tick_timer_running();
+
+    /**
+     * @brief Programs the host tick timer
+     * @param period_us tick period in us, 0 to stop the timer
+     * @param first_us time to the first tick in us, 0 for a full period
+     */
+    void set_tick_timer(uint64_t period_us, uint64_t first_us = 0);
+
+    /**
+     * @brief Sleeps the idle time at the current speed, stops early on a host input or a speed change
+     * @param expected_idle ticks until the next task timeout
+     * @param until_woken no task has a timeout, sleep until a host input comes
+     * @param phase set to the virtual time slept into the next tick, in ns
+     * @return ticks to step, less than expected_idle
+     */
+    TickType_t pace_idle(TickType_t expected_idle, bool until_woken, uint64_t *phase);
+
+    /**
+     * @brief Steps over idle time, in deterministic runs, in sleep modes and as fast as possible
+     *
+     * Steps to the next timeout, after the scaled time unless running as fast
+     * as possible or fast forwarding. A host input stops the sleep and the step at the tick
+     * reached. In deterministic runs this is the only way the tick count moves.
+     * @param expected_idle ticks until the next task timeout
+     * @param until_woken no task has a timeout, sleep until a host input comes
+     * @param fast do not sleep the scaled time
+     * @param switch_required set to pdTRUE if the last tick unblocked a task that should run now
+     * @return ticks stepped over
+     */
+    TickType_t step_idle(TickType_t expected_idle, bool until_woken, bool fast,
+                         BaseType_t *switch_required = nullptr);
+
+    /**
+     * @brief Gives the kernel one tick, from the idle task
+     * @return pdTRUE if the tick unblocked a task that should run now
+     */
+    static BaseType_t add_tick();
+
+    /**
+     * @brief Event task body
+     * @param parameters the EventQueue
+     */
+    [[noreturn]] static void task_loop(void *parameters);
+
+    std::vector<Event> nodes;
+    int free_nodes;     /**< first free node, -1 if none */
+    std::array<std::array<int, EVENT_WHEEL_SLOTS>, EVENT_WHEEL_LEVELS> slots;  /**< first node of each slot */
+    std::array<uint64_t, EVENT_WHEEL_LEVELS> slot_bits;                        /**< occupied slots of each level */
+    uint32_t level_bits;    /**< levels with occupied slots */
+    uint64_t wheel_tick;    /**< wheel time, events up to this tick are in the ready heap */
+    std::vector<int> ready; /**< heap of the nodes in their tick, the earliest on top */
+    TaskHandle_t task;
+    uint64_t next_seq;
+    std::atomic<uint64_t> last_ticks;
+    std::atomic<double> sim_speed;
+    std::atomic<uint64_t> skipped_ticks;
+    std::atomic<int64_t> tick_start;    /**< host time of the start of the current tick, in ns */
+    std::atomic<double> tick_scale;     /**< virtual ns per host ns */
+    std::mutex idle_mutex;
+    std::condition_variable idle_wake;
+    bool idle_sleeping;
+    bool determ;                    /**< deterministic mode */
+    uint64_t seed;                  /**< order of events at the same time, 0 for post order */
+    uint64_t next_input_seq;        /**< post order of the host inputs */
+    std::vector<EventInput> input_kinds;
+    std::atomic<HostInput *> inputs;    /**< host inputs not taken by the event task yet, the last one first */
+    FILE *record;                   /**< file the host inputs are written to, nullptr for none */
+    const char *replay;             /**< file the host inputs are read from, nullptr for none */
+    bool idle_stepped;              /**< idle() has run since the last idle hook */
+};
+
+extern EventQueue events;
+
+/**
+ * @brief Keeps the other tasks out while in scope, see the locking rules of EventQueue
+ *
+ * Suspends the scheduler, so it nests and the idle task may take it with the
+ * scheduler already suspended. The peripheral models guard the state their
+ * register callbacks and their events share with it, never with a host mutex.
+ * Before the scheduler starts only the main thread runs, nothing to exclude.
+ */
+class EventLock {
+public:
+    EventLock() : suspended(xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        if (suspended) {
+            vTaskSuspendAll();
+        }
+    }
+
+    ~EventLock() {
+        if (suspended) {
+            (void) xTaskResumeAll();
+        }
+    }
+
+    EventLock(const EventLock &) = delete;
+    EventLock &operator=(const EventLock &) = delete;
+
+private:
+    bool suspended;
+};
+
+/**
+ * @brief Copy of a peripheral state that host threads (GUI) read without locks
+ *
+ * A sequence lock: the tasks publish the state under an EventLock, so there is
+ * a single writer, and a reader retries when a publish ran meanwhile. The
+ * words are atomics, so a torn read is retried instead of being a data race.
+ * @tparam T trivially copyable state, a multiple of 4 bytes
+ */
+template<typename T>
+class HostCopy {
+    static_assert(std::is_trivially_copyable<T>::value && (sizeof(T) % sizeof(uint32_t) == 0),
+                  "HostCopy holds whole words");
+
+public:
+    /**
+     * @brief Publishes a new state, from a task holding an EventLock
+     * @param val new state
+     */
+    void publish(const T &val) {
+        uint32_t words[HOST_COPY_WORDS];
+        uint32_t s = seq.load(std::memory_order_relaxed);
+
+        memcpy(words, &val, sizeof(T));
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < HOST_COPY_WORDS; i++) {
+            data[i].store(words[i], std::memory_order_relaxed);
+        }
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    /**
+     * @brief Reads the last published state, from any thread
+     */
+    T read() const {
+        uint32_t words[HOST_COPY_WORDS];
+        uint32_t s;
+        T val;
+
+        do {
+            s = seq.load(std::memory_order_acquire);
+            for (size_t i = 0; i < HOST_COPY_WORDS; i++) {
+                words[i] = data[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((s & 1) || (s != seq.load(std::memory_order_relaxed)));
+
+        memcpy(&val, words, sizeof(T));
+        return val;
+    }
+
+private:
+    static constexpr size_t HOST_COPY_WORDS = sizeof(T) / sizeof(uint32_t);
+
+    std::atomic<uint32_t> seq{0};                       /**< odd while a publish runs */
+    std::atomic<uint32_t> data[HOST_COPY_WORDS] = {};   /**< state words */
+};
+
+#endif /* SIM_EVENTQUEUE_H_ */
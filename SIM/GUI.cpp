@@ -55,10 +55,14 @@ using namespace gl;
 #include "SIM/HAL.h"
 #include <SIM/SoC.h>
 #include "Memory.h"
+#include "EventQueue.h"
 
 
 void *gui_thread(void *ptr);
 
+/** Samples of the PWM output plot */
+#define PWM_WAVE_SAMPLES (200)
+
 /**
  * @brief Text buffer to keep the trace output
  */
@@ -86,6 +90,8 @@ void *gui_thread(void *ptr) {
 
     (void) ptr;
 
+    EventQueue::set_host_thread();
+
     // Setup SDL
     // (Some versions of SDL before <2.0.10 appears to have performance/stalling issues on a minority of Windows systems,
     // depending on whether SDL_INIT_GAMECONTROLLER is enabled or disabled.. updating to latest version of SDL is recommended!)
@@ -171,6 +177,9 @@ void *gui_thread(void *ptr) {
     int adc_0 = 0;
     int adc_1 = 0;
 
+    float speed = 1.0f;
+    bool afap = false;
+
     while (!done) {
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
@@ -187,6 +196,9 @@ void *gui_thread(void *ptr) {
         ImGui_ImplSDL2_NewFrame(window);
         ImGui::NewFrame();
 
+        /* Firmware writes through the Registers.h structs are seen here */
+        memory.sync_direct();
+
         {
             /************** GPIO ***************/
             ImGui::Begin("GPIO");
@@ -274,16 +286,30 @@ void *gui_thread(void *ptr) {
             ImGui::Button("PWM");
             ImGui::PopStyleColor(3);
             ImGui::PopID();
+            /* Output over the last two periods, sampled from the exact waveform */
+            float pwm_wave[PWM_WAVE_SAMPLES] = {};
+            unsigned int timer_freq = TimerFreqGet();
+            uint32_t timer_top = memory.peek(ADDR_TIMER_TOP);
+            if ((timer_freq != 0) && (timer_top != 0)) {
+                uint64_t window = 2 * (timer_top + 1ULL) * 1000000000ULL / timer_freq;
+                uint64_t end = events.host_now();
+                uint64_t begin = (end > window) ? end - window : 0;
+
+                for (int i = 0; i < PWM_WAVE_SAMPLES; i++) {
+                    pwm_wave[i] = PWMOutputAt(begin + (end - begin) * i / PWM_WAVE_SAMPLES) ? 1.0f : 0.0f;
+                }
+            }
+            ImGui::PlotLines("Output", pwm_wave, PWM_WAVE_SAMPLES, 0, nullptr, -0.1f, 1.1f, ImVec2(0, 40));
             ImGui::End();
 
             /************** RTC ***************/
             ImGui::Begin("RTC");
-            uint32_t now = RTC_CounterGet();
+            uint32_t now = RTCCountGet();
             struct tm *ptm = localtime((time_t *) &now);
             ImGui::Text("CNT: %u (%02d/%02d/%04d %02d:%02d:%02d)", now, ptm->tm_mday, ptm->tm_mon + 1,
                         ptm->tm_year + 1900,
                         ptm->tm_hour, ptm->tm_min, ptm->tm_sec);
-            now = RTC_CompareGet();
+            now = memory.peek(ADDR_RTC_CMP);
             ptm = localtime((time_t *) &now);
             ImGui::Text("CMP: %u (%02d/%02d/%04d %02d:%02d:%02d)", now, ptm->tm_mday, ptm->tm_mon + 1,
                         ptm->tm_year + 1900,
@@ -301,6 +327,80 @@ void *gui_thread(void *ptr) {
             std::string device = getUART_Path();
             ImGui::Text("Baudrate %d %s", UART_GetBaudRate(), device.c_str());
             ImGui::End();
+
+            /**************** Simulation **********/
+            ImGui::Begin("Simulation");
+            ImGui::Text("Virtual time %.3f s", events.host_now() / 1e9);
+            if (SoC_SpeedGet() != 0) {
+                speed = (float) SoC_SpeedGet();
+            }
+            afap = (SoC_SpeedGet() == 0);
+            if (ImGui::SliderFloat("Speed", &speed, 0.01f, 1000.0f, "%.2fx", ImGuiSliderFlags_Logarithmic)) {
+                SoC_SpeedSet(afap ? 0 : speed);
+            }
+            if (ImGui::Checkbox("As fast as possible", &afap)) {
+                SoC_SpeedSet(afap ? 0 : speed);
+            }
+            ImGui::End();
+
+            /**************** Registers **********/
+            ImGui::Begin("Registers");
+            if (ImGui::Button("Reset counters")) {
+                memory.reset_stats();
+            }
+            if (ImGui::BeginTable("reg_stats", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg |
+                                                  ImGuiTableFlags_ScrollY)) {
+                ImGui::TableSetupScrollFreeze(0, 1);
+                ImGui::TableSetupColumn("Register");
+                ImGui::TableSetupColumn("Address");
+                ImGui::TableSetupColumn("Value");
+                ImGui::TableSetupColumn("Reads");
+                ImGui::TableSetupColumn("Writes");
+                ImGui::TableSetupColumn("Hook us");
+                ImGui::TableHeadersRow();
+                for (uint32_t i = 0; i < MEM_N_REGS; i++) {
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%s", reg_table[i].name);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("0x%05X", reg_table[i].addr);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("0x%08X", memory.peek(reg_table[i].addr));
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%llu", (unsigned long long) reg_stats[i].reads.load(std::memory_order_relaxed));
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%llu", (unsigned long long) reg_stats[i].writes.load(std::memory_order_relaxed));
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.1f", reg_stats[i].hook_ns.load(std::memory_order_relaxed) / 1000.0);
+                }
+                ImGui::EndTable();
+            }
+            ImGui::End();
+
+            /**************** Watchpoints **********/
+            ImGui::Begin("Watchpoints");
+            if (memory.paused()) {
+                ImGui::Text("Paused on watchpoint");
+                ImGui::SameLine();
+                if (ImGui::Button("Resume")) {
+                    memory.resume();
+                }
+            }
+            for (int i = 0; i < MEM_MAX_WATCHES; i++) {
+                Watchpoint watch;
+                if (memory.get_watch(i, watch)) {
+                    ImGui::Text("#%d 0x%05X-0x%05X mask 0x%08X %s%s: %llu hits", i, watch.first, watch.last,
+                                watch.mask, watch.on_read ? "R" : "", watch.on_write ? "W" : "",
+                                (unsigned long long) watch.hits);
+                    ImGui::SameLine();
+                    ImGui::PushID(i);
+                    if (ImGui::SmallButton("Remove")) {
+                        memory.remove_watch(i);
+                    }
+                    ImGui::PopID();
+                }
+            }
+            ImGui::End();
         }
 
         // Rendering
@@ -328,7 +428,7 @@ void *gui_thread(void *ptr) {
 void gui_add_trace(char c) {
 
     if (c != 0) {
-        memory[ADDR_TRACE] = 0;
+        memory.poke(ADDR_TRACE, 0);
         trace_console->appendf("%c", c);
     }
 }
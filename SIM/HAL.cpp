@@ -198,15 +198,41 @@ bool GPIO_IntDisable(Port port, uint32_t pin) {
     return true;
 }
 
-bool NVIC_IntClear(uint32_t irq) {
+bool NVIC_Enable(uint32_t irq) {
+    if (irq >= 32) {
+        return false;
+    }
+    memory[ADDR_NVIC_CTRL] |= (1U << irq);
+    return true;
+}
 
-#if 1
-    memory[ADDR_NVIC_IRQ] &= ~(1 << irq);
-#else
-    uint32_t aux = memory[ADDR_NVIC_IRQ];
-    aux &= ~(1 << irq);
-    memory[ADDR_NVIC_IRQ] = aux;
-#endif
+bool NVIC_Disable(uint32_t irq) {
+    if (irq >= 32) {
+        return false;
+    }
+    memory[ADDR_NVIC_CTRL] &= ~(1U << irq);
+    return true;
+}
+
+bool NVIC_PrioritySet(uint32_t irq, uint32_t prio) {
+    if ((irq >= 32) || (prio >= NVIC_PRIO_LEVELS)) {
+        return false;
+    }
+
+    uint32_t addr = ADDR_NVIC_PRIO0 + (irq / NVIC_PRIO_PER_REG) * sizeof(uint32_t);
+    uint32_t shift = (irq % NVIC_PRIO_PER_REG) * NVIC_PRIO_BITS;
+    uint32_t aux = memory[addr];
+    aux &= ~((NVIC_PRIO_LEVELS - 1) << shift);
+    aux |= prio << shift;
+    memory[addr] = aux;
+    return true;
+}
+
+bool NVIC_IntClear(uint32_t irq) {
+    if (irq >= 32) {
+        return false;
+    }
+    memory[ADDR_NVIC_IRQ] &= ~(1U << irq);
     return true;
 }
 
@@ -265,6 +291,20 @@ bool TIMER_Disable() {
     return true;
 }
 
+uint32_t TIMER_CounterGet() {
+    return memory[ADDR_TIMER_CNT];
+}
+
+bool TIMER_IntEnable(timer_irq_t irq) {
+    memory[ADDR_TIMER_CTRL] |= irq;
+    return true;
+}
+
+bool TIMER_IntDisable(timer_irq_t irq) {
+    memory[ADDR_TIMER_CTRL] &= ~irq;
+    return true;
+}
+
 /************************************ RTC  ***********************************/
 bool RTC_Enable() {
 #if 1
@@ -448,10 +488,8 @@ bool ADC_EnableChannel(ADC_channel_t ch) {
 }
 
 
-#define RTC_CNT  (&memory[ADDR_RTC_CNT])
-
 uint32_t get_test() {
-   return *RTC_CNT;
+   return memory[ADDR_RTC_CNT];
 }
 
 /******************** WDT **********************/
@@ -471,15 +509,108 @@ bool WDOG_Feed() {
     return true;
 }
 
+/******************** Power ********************/
+
+void HAL_WFI(void) {
+    SoC_WaitForInterrupt(POWER_SLEEP);
+}
+
+void HAL_DeepSleep(void) {
+    SoC_WaitForInterrupt(POWER_DEEP_SLEEP);
+}
+
+bool POWER_WakeSourceSet(uint32_t irq_mask) {
+    memory[ADDR_PWR_WAKE] = irq_mask;
+    return true;
+}
+
+uint32_t POWER_ResidencyGet(power_mode_t mode) {
+    switch (mode) {
+        case POWER_RUN:
+            return memory[ADDR_PWR_RUN];
+        case POWER_SLEEP:
+            return memory[ADDR_PWR_SLEEP];
+        case POWER_DEEP_SLEEP:
+            return memory[ADDR_PWR_DEEP];
+        default:
+            return 0;
+    }
+}
+
 
 /******************************** Memory access ******************************/
 void HAL_MemoryWrite(uint32_t addr, uint32_t data) {
-    memory[addr] = data;
+    memory.write(addr, data);
 }
 
 uint32_t HAL_MemoryRead(uint32_t addr) {
-    return memory[addr];
+    return memory.read(addr);
+}
+
+void HAL_MemoryReadBlock(uint32_t addr, uint32_t *data, uint32_t n_words) {
+    memory.read_block(addr, data, n_words);
+}
+
+void HAL_MemoryWriteBlock(uint32_t addr, const uint32_t *data, uint32_t n_words) {
+    memory.write_block(addr, data, n_words);
+}
+
+void HAL_MemoryFill(uint32_t addr, uint32_t data, uint32_t n_words) {
+    memory.fill(addr, data, n_words);
+}
+
+
+
+
+bool HAL_BusFaultConfig(bus_fault_action_t action) {
+    switch (action) {
+        case BUS_FAULT_LOG:
+            memory.set_bus_fault(BusFault::Log);
+            break;
+        case BUS_FAULT_IRQ:
+            memory.set_bus_fault(BusFault::Irq, SoC_BusFaultIRQ);
+            break;
+        case BUS_FAULT_ABORT:
+            memory.set_bus_fault(BusFault::Abort);
+            break;
+        default:
+            return false;
+    }
+    return true;
 }
 
+uint32_t HAL_BusFaultCount() {
+    return mem_stats.bus_faults.load(std::memory_order_relaxed);
+}
 
+int HAL_WatchAdd(uint32_t first, uint32_t last, uint32_t mask, bool on_read, bool on_write,
+                 watch_action_t action, watch_cb_t cb) {
+    switch (action) {
+        case WATCH_LOG:
+            return memory.add_watch(first, last, mask, on_read, on_write, WatchAction::Log);
+        case WATCH_COUNT:
+            return memory.add_watch(first, last, mask, on_read, on_write, WatchAction::Count);
+        case WATCH_CALLBACK:
+            if (cb == nullptr) {
+                return -1;
+            }
+            return memory.add_watch(first, last, mask, on_read, on_write, WatchAction::Callback, cb);
+        case WATCH_PAUSE:
+            return memory.add_watch(first, last, mask, on_read, on_write, WatchAction::Pause);
+        default:
+            return -1;
+    }
+}
+
+bool HAL_WatchRemove(int id) {
+    return memory.remove_watch(id);
+}
+
+uint32_t HAL_WatchHits(int id) {
+    Watchpoint watch;
 
+    if (!memory.get_watch(id, watch)) {
+        return 0;
+    }
+    return watch.hits;
+}
@@ -12,6 +12,7 @@
 
 #include "FreeRTOS.h"
 #include "semphr.h"
+#include "Registers.h"
 
 #ifdef __cplusplus
 #include <cstdint>
@@ -61,6 +62,14 @@ typedef enum {
     PRESCALER256 = 256,
 } timer_prescaler_t;
 
+/**
+ * @brief TIMER interrupt sources, bits of TIMER_CTRL
+ */
+typedef enum {
+    TIMER_IRQ_OVERFLOW = 0x02,
+    TIMER_IRQ_COMPARE = 0x04,
+} timer_irq_t;
+
 /**
  * @brief Watchdog pre-scaler possible values
  */
@@ -77,6 +86,40 @@ typedef enum {
     WDT_8000_MS,
 } wdt_cycles_t;
 
+/**
+ * @brief Action taken on accesses to unmapped addresses
+ */
+typedef enum {
+    BUS_FAULT_LOG = 0,
+    BUS_FAULT_IRQ,
+    BUS_FAULT_ABORT,
+} bus_fault_action_t;
+
+/**
+ * @brief Action taken when a watchpoint triggers
+ */
+typedef enum {
+    WATCH_LOG = 0,
+    WATCH_COUNT,
+    WATCH_CALLBACK,
+    WATCH_PAUSE,
+} watch_action_t;
+
+/**
+ * @brief Power modes, time spent in each one is accounted in the PWR registers
+ */
+typedef enum {
+    POWER_RUN = 0,
+    POWER_SLEEP = 1,
+    POWER_DEEP_SLEEP = 2,
+} power_mode_t;
+
+/**
+ * @brief Watchpoint callback, receives the register address, the value before
+ * and after the access and true on writes
+ */
+typedef void (*watch_cb_t)(uint32_t addr, uint32_t old_val, uint32_t new_val, bool write);
+
 /************************************ GPIO ***********************************/
 
 /**
@@ -151,6 +194,17 @@ bool NVIC_Disable(uint32_t irq);
  */
 bool NVIC_IntClear(uint32_t irq);
 
+/**
+ * @brief Sets the priority of an IRQ
+ *
+ * The pending ISR with the highest priority runs first and preempts a running
+ * ISR of a lower priority. IRQs of the same priority run by IRQ number.
+ * @param irq IRQ to configure
+ * @param prio 0 (highest) to NVIC_PRIO_LEVELS - 1 (lowest), 0 after reset
+ * @return true on success
+ */
+bool NVIC_PrioritySet(uint32_t irq, uint32_t prio);
+
 /************************************ Trace ***********************************/
 
 /**
@@ -201,6 +255,29 @@ bool TIMER_Enable();
  */
 bool TIMER_Disable();
 
+/**
+ * @brief Gets TIMER counter value
+ * @return counter value
+ */
+uint32_t TIMER_CounterGet();
+
+/**
+ * @brief Enables an IRQ of the TIMER
+ *
+ * The overflow IRQ (TIMER_OVF_ISR) triggers when the counter goes from TOP
+ * to 0, the compare IRQ (TIMER_CMP_ISR) when it reaches the compare value.
+ * @param irq interrupt source
+ * @return true on success
+ */
+bool TIMER_IntEnable(timer_irq_t irq);
+
+/**
+ * @brief Disables an IRQ of the TIMER
+ * @param irq interrupt source
+ * @return true on success
+ */
+bool TIMER_IntDisable(timer_irq_t irq);
+
 /************************************ I2C  ***********************************/
 
 
@@ -406,6 +483,40 @@ bool WDOG_PrescalerSet(wdt_cycles_t pres);
  */
 bool WDOG_Feed();
 
+/*********************************** Power ***********************************/
+
+/**
+ * @brief Sleeps until an IRQ is raised, like the WFI instruction
+ *
+ * Blocks the calling task until any NVIC_IRQ bit is set, returns at once if
+ * one is already pending. While every task is blocked the idle time is
+ * skipped to the next timeout or peripheral event and counted as sleep.
+ */
+void HAL_WFI(void);
+
+/**
+ * @brief Deep sleep until an IRQ selected with POWER_WakeSourceSet() is raised
+ *
+ * As HAL_WFI(), but other IRQs do not wake the task up and the idle time is
+ * counted as deep sleep. With no wake source selected (PWR_WAKE is 0 after
+ * reset) it would never return, so it prints a warning and sleeps as HAL_WFI().
+ */
+void HAL_DeepSleep(void);
+
+/**
+ * @brief Selects the IRQs that wake up from deep sleep
+ * @param irq_mask bit n set for IRQ #n
+ * @return true
+ */
+bool POWER_WakeSourceSet(uint32_t irq_mask);
+
+/**
+ * @brief Virtual time spent in a power mode
+ * @param mode power mode
+ * @return time in ms
+ */
+uint32_t POWER_ResidencyGet(power_mode_t mode);
+
 /******************************** Memory access ******************************/
 
 /**
@@ -422,6 +533,73 @@ void HAL_MemoryWrite(uint32_t addr, uint32_t data);
  */
 uint32_t HAL_MemoryRead(uint32_t addr);
 
+/**
+ * @brief Reads a range of consecutive words
+ * @param addr address of the first word
+ * @param data buffer to store the data read
+ * @param n_words number of words to read
+ */
+void HAL_MemoryReadBlock(uint32_t addr, uint32_t *data, uint32_t n_words);
+
+/**
+ * @brief Writes a range of consecutive words
+ * @param addr address of the first word
+ * @param data data to write
+ * @param n_words number of words to write
+ */
+void HAL_MemoryWriteBlock(uint32_t addr, const uint32_t *data, uint32_t n_words);
+
+/**
+ * @brief Writes the same value to a range of consecutive words
+ * @param addr address of the first word
+ * @param data value to write
+ * @param n_words number of words to write
+ */
+void HAL_MemoryFill(uint32_t addr, uint32_t data, uint32_t n_words);
+
+/**
+ * @brief Selects what happens on accesses to unmapped addresses
+ * @param action BUS_FAULT_LOG prints the access, BUS_FAULT_IRQ triggers
+ * BUS_FAULT_ISR and BUS_FAULT_ABORT stops the simulation
+ * @return true on success
+ */
+bool HAL_BusFaultConfig(bus_fault_action_t action);
+
+/**
+ * @brief Returns how many accesses to unmapped addresses happened
+ * @return number of bus faults
+ */
+uint32_t HAL_BusFaultCount();
+
+/**
+ * @brief Adds a watchpoint on a range of registers
+ * @param first first address watched
+ * @param last last address watched
+ * @param mask bits watched, writes trigger when they change one of them
+ * @param on_read trigger on every read
+ * @param on_write trigger on writes
+ * @param action WATCH_LOG prints the access, WATCH_COUNT only counts it,
+ * WATCH_CALLBACK calls cb and WATCH_PAUSE stops the task until resumed from the GUI
+ * @param cb callback for WATCH_CALLBACK, may be NULL otherwise
+ * @return watchpoint id, -1 on error
+ */
+int HAL_WatchAdd(uint32_t first, uint32_t last, uint32_t mask, bool on_read, bool on_write,
+                 watch_action_t action, watch_cb_t cb);
+
+/**
+ * @brief Removes a watchpoint
+ * @param id watchpoint id returned by HAL_WatchAdd
+ * @return true on success
+ */
+bool HAL_WatchRemove(int id);
+
+/**
+ * @brief Returns how many times a watchpoint triggered
+ * @param id watchpoint id returned by HAL_WatchAdd
+ * @return number of hits
+ */
+uint32_t HAL_WatchHits(int id);
+
 #ifdef __cplusplus
 }
 #endif
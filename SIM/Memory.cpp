@@ -6,12 +6,984 @@
  */
 // SPDX-License-Identifier: GPL-3.0-or-later
 
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "Memory.h"
+#include "RegShm.h"
+#include "Registers.h"
+
+alignas(sizeof(std::atomic<uint32_t>) * MEM_REG_FILE_WORDS) std::atomic<uint32_t> reg_data[MEM_REG_FILE_WORDS];
+
+volatile uint32_t *const reg_file = reinterpret_cast<volatile uint32_t *>(reg_data);
+
+static_assert(sizeof(reg_data) == REG_SHM_HDR_OFFSET - REG_SHM_REGS_OFFSET, "register file must fill the first page");
+
+RegStats reg_stats[MEM_N_REGS];
+
+std::atomic<uint8_t> page_hooks[MEM_PAGES];
 
 /**
- * MCU memory
+ * @brief Sequence counters of the exported blocks, nullptr until export_shm()
+ */
+static std::atomic<uint32_t> *page_seq = nullptr;
+
+/**
+ * @brief Writer guard of the sequence locks, nullptr for none, see MemoryMap::set_shm_guard()
+ */
+static std::atomic<shm_guard_func> seq_enter(nullptr);
+static std::atomic<shm_guard_func> seq_exit(nullptr);
+
+MemStats mem_stats = {};
+
+/**
+ * @brief Last unmapped address decoded by each thread
+ */
+static thread_local uint32_t fault_addr;
+
+/**
+ * @brief Read callback for unmapped addresses
+ * @param val unused
+ * @param param unused
+ * @return 0
+ */
+static uint32_t unmapped_rd_cb(uint32_t val, uint32_t param) {
+    (void) val;
+    (void) param;
+    memory.bus_fault(fault_addr, false);
+    return 0;
+}
+
+/**
+ * @brief Write callback for unmapped addresses
+ * @param old_val unused
+ * @param val unused
+ * @param param unused
+ */
+static uint32_t unmapped_wr_cb(uint32_t old_val, uint32_t val, uint32_t param) {
+    (void) old_val;
+    (void) val;
+    (void) param;
+    memory.bus_fault(fault_addr, true);
+    return 0;
+}
+
+/**
+ * @brief Description of the register used for unmapped accesses
+ */
+static constexpr RegDesc unmapped_desc = {"(unmapped)", 0, 0, 0xFFFFFFFF, 0, 0, unmapped_rd_cb, unmapped_wr_cb, 0};
+
+/**
+ * @brief Storage of the register used for unmapped accesses, always 0
+ */
+static std::atomic<uint32_t> unmapped_data(0);
+
+/**
+ * @brief Access counters of unmapped addresses
+ */
+static RegStats unmapped_stats_data;
+
+MemoryMap::MemoryMap() : fault_action(BusFault::Log), fault_irq_cb(nullptr), regions(), n_regions(0),
+                         watches(), subscriptions(), watch_pause_cb(nullptr), watch_resume_cb(nullptr),
+                         watch_paused(0), direct_shadow(),
+                         shm_name(), shm_exported(false) {
+    reset();
+}
+
+void MemoryMap::reset() {
+    for (uint32_t i = 0; i < MEM_N_REGS; i++) {
+        reg_data[i].store(reg_table[i].reset, std::memory_order_relaxed);
+        direct_shadow[i].store(reg_table[i].reset, std::memory_order_relaxed);
+    }
+}
+
+const MemRegion *MemoryMap::find_region(uint32_t addr) const {
+    uint32_t n = n_regions.load(std::memory_order_acquire);
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (addr - regions[i].base < regions[i].size) {
+            return &regions[i];
+        }
+    }
+    return nullptr;
+}
+
+bool MemoryMap::add_region(uint32_t base, uint32_t size, uint8_t *data) {
+    uint32_t n = n_regions.load(std::memory_order_acquire);
+
+    if ((n >= MEM_MAX_REGIONS) || (size == 0) || ((base | size) & 0x03) ||
+        ((base >> MEM_PAGE_SHIFT) < MEM_PAGES) || ((uint64_t) base + size > 0x100000000ULL)) {
+        printf("Memory: invalid region at 0x%08X (%u bytes)\n", base, size);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        if ((base < regions[i].base + regions[i].size) && (regions[i].base < base + size)) {
+            printf("Memory: region at 0x%08X overlaps 0x%08X\n", base, regions[i].base);
+            return false;
+        }
+    }
+
+    regions[n] = {base, size, data};
+    n_regions.store(n + 1, std::memory_order_release);
+    return true;
+}
+
+bool MemoryMap::add_ram(uint32_t base, uint32_t size) {
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (data == MAP_FAILED) {
+        printf("Memory: cannot allocate %u bytes of RAM\n", size);
+        return false;
+    }
+
+    if (!add_region(base, size, (uint8_t *) data)) {
+        munmap(data, size);
+        return false;
+    }
+    return true;
+}
+
+bool MemoryMap::add_flash(uint32_t base, uint32_t size, const char *path, bool persistent) {
+    int fd = open(path, persistent ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    struct stat st = {};
+
+    if ((fd < 0) || (fstat(fd, &st) != 0)) {
+        printf("Memory: cannot open Flash file %s\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    uint32_t file_size = std::min((uint64_t) st.st_size, (uint64_t) size);
+    void *data;
+
+    if (persistent) {
+        if ((file_size < size) && (ftruncate(fd, size) != 0)) {
+            printf("Memory: cannot resize Flash file %s\n", path);
+            close(fd);
+            return false;
+        }
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    } else {
+        /* Anonymous erased area with the file mapped copy-on-write on top */
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if ((data != MAP_FAILED) && (file_size > 0) &&
+            (mmap(data, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+            munmap(data, size);
+            data = MAP_FAILED;
+        }
+    }
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        printf("Memory: cannot map Flash file %s\n", path);
+        return false;
+    }
+
+    memset((uint8_t *) data + file_size, 0xFF, size - file_size);
+
+    if (!add_region(base, size, (uint8_t *) data)) {
+        munmap(data, size);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Loads a word from RAM or Flash storage
+ * @param mem storage of the word
+ * @param addr address of the word
+ */
+static uint32_t region_load(const uint8_t *mem, uint32_t addr) {
+    uint32_t val;
+
+    if ((addr & 0x03) == 0) {
+        val = __atomic_load_n((const uint32_t *) mem, __ATOMIC_RELAXED);
+    } else {
+        memcpy(&val, mem, sizeof(val));
+    }
+    return val;
+}
+
+/**
+ * @brief Stores a word to RAM or Flash storage
+ * @param mem storage of the word
+ * @param addr address of the word
+ * @param val value to store
+ */
+static void region_store(uint8_t *mem, uint32_t addr, uint32_t val) {
+    if ((addr & 0x03) == 0) {
+        __atomic_store_n((uint32_t *) mem, val, __ATOMIC_RELAXED);
+    } else {
+        memcpy(mem, &val, sizeof(val));
+    }
+}
+
+/**
+ * @brief Copies words out of RAM or Flash storage
+ *
+ * Aligned words are loaded one by one like region_load(), so a block access
+ * does not race with single word stores of other tasks.
+ * @param dst buffer for the data read
+ * @param mem storage of the first word
+ * @param addr address of the first word
+ * @param n_words number of words to copy
  */
-std::unordered_map<uint32_t, WordMem> memory;
+static void region_load_block(uint32_t *dst, const uint8_t *mem, uint32_t addr, uint32_t n_words) {
+    if ((addr & 0x03) == 0) {
+        for (uint32_t i = 0; i < n_words; i++) {
+            dst[i] = __atomic_load_n((const uint32_t *) mem + i, __ATOMIC_RELAXED);
+        }
+    } else {
+        memcpy(dst, mem, n_words * 4);
+    }
+}
+
+/**
+ * @brief Copies words into RAM or Flash storage, see region_load_block()
+ * @param mem storage of the first word
+ * @param addr address of the first word
+ * @param src data to write
+ * @param n_words number of words to copy
+ */
+static void region_store_block(uint8_t *mem, uint32_t addr, const uint32_t *src, uint32_t n_words) {
+    if ((addr & 0x03) == 0) {
+        for (uint32_t i = 0; i < n_words; i++) {
+            __atomic_store_n((uint32_t *) mem + i, src[i], __ATOMIC_RELAXED);
+        }
+    } else {
+        memcpy(mem, src, n_words * 4);
+    }
+}
+
+uint32_t MemoryMap::read_region(uint32_t addr) {
+    uint32_t n;
+    uint8_t *mem = region_range(addr, 1, n);
+
+    if (mem == nullptr) {
+        return unmapped_reg(addr);
+    }
+    return region_load(mem, addr);
+}
+
+void MemoryMap::write_region(uint32_t addr, uint32_t val) {
+    uint32_t n;
+    uint8_t *mem = region_range(addr, 1, n);
+
+    if (mem == nullptr) {
+        unmapped_reg(addr) = val;
+    } else {
+        region_store(mem, addr, val);
+    }
+}
+
+uint32_t MemoryMap::peek_region(uint32_t addr) const {
+    uint32_t n;
+    const uint8_t *mem = region_range(addr, 1, n);
+
+    return mem ? region_load(mem, addr) : 0;
+}
+
+void MemoryMap::poke_region(uint32_t addr, uint32_t val) {
+    uint32_t n;
+    uint8_t *mem = region_range(addr, 1, n);
+
+    if (mem) {
+        region_store(mem, addr, val);
+    }
+}
+
+uint8_t *MemoryMap::region_range(uint32_t addr, uint32_t n_words, uint32_t &n) const {
+    if ((addr >> MEM_PAGE_SHIFT) < MEM_PAGES) {
+        return nullptr;
+    }
+
+    const MemRegion *r = find_region(addr);
+    if (r == nullptr) {
+        return nullptr;
+    }
+
+    uint32_t avail = (r->size - (addr - r->base)) / 4;
+    if (avail == 0) {
+        return nullptr;
+    }
+
+    n = std::min(n_words, avail);
+    return r->data + (addr - r->base);
+}
+
+int MemoryMap::decode_range(uint32_t addr, uint32_t n_words, uint32_t &n) const {
+    uint32_t page = addr >> MEM_PAGE_SHIFT;
+
+    if ((page < MEM_PAGES) && ((addr & 0x03) == 0)) {
+        RegPage regs = reg_pages[page];
+        uint32_t idx = (addr & ((1 << MEM_PAGE_SHIFT) - 1)) >> 2;
+
+        if (idx < regs.n_words) {
+            n = std::min(n_words, regs.n_words - idx);
+            return regs.first + idx;
+        }
+    }
+
+    n = 1;
+    return -1;
+}
+
+/* Each range is decoded once. RAM and Flash are copied word by word,
+ * registers without callbacks are plain loads and stores and the others keep
+ * their callback semantics word by word. */
+
+void MemoryMap::read_block(uint32_t addr, uint32_t *dst, uint32_t n_words) {
+    while (n_words > 0) {
+        uint32_t n;
+        int reg;
+        uint8_t *mem = region_range(addr, n_words, n);
+
+        if (mem) {
+            region_load_block(dst, mem, addr, n);
+        } else if ((reg = decode_range(addr, n_words, n)) >= 0) {
+            for (uint32_t i = 0; i < n; i++) {
+                dst[i] = mapped_reg(reg + i);
+            }
+        } else {
+            dst[0] = unmapped_reg(addr);
+        }
+
+        addr += n * 4;
+        dst += n;
+        n_words -= n;
+    }
+}
+
+void MemoryMap::write_block(uint32_t addr, const uint32_t *src, uint32_t n_words) {
+    while (n_words > 0) {
+        uint32_t n;
+        int reg;
+        uint8_t *mem = region_range(addr, n_words, n);
+
+        if (mem) {
+            region_store_block(mem, addr, src, n);
+        } else if ((reg = decode_range(addr, n_words, n)) >= 0) {
+            for (uint32_t i = 0; i < n; i++) {
+                mapped_reg(reg + i) = src[i];
+            }
+        } else {
+            unmapped_reg(addr) = src[0];
+        }
+
+        addr += n * 4;
+        src += n;
+        n_words -= n;
+    }
+}
+
+void MemoryMap::fill(uint32_t addr, uint32_t val, uint32_t n_words) {
+    while (n_words > 0) {
+        uint32_t n;
+        int reg;
+        uint8_t *mem = region_range(addr, n_words, n);
+
+        if (mem) {
+            for (uint32_t i = 0; i < n; i++) {
+                region_store(mem + i * 4, addr + i * 4, val);
+            }
+        } else if ((reg = decode_range(addr, n_words, n)) >= 0) {
+            for (uint32_t i = 0; i < n; i++) {
+                mapped_reg(reg + i) = val;
+            }
+        } else {
+            unmapped_reg(addr) = val;
+        }
+
+        addr += n * 4;
+        n_words -= n;
+    }
+}
+
+WordMem MemoryMap::unmapped_reg(uint32_t addr) {
+    fault_addr = addr;
+    return WordMem(&unmapped_data, &unmapped_desc, &unmapped_stats_data);
+}
+
+void MemoryMap::report(FILE *out) const {
+    uint32_t order[MEM_N_REGS];
+    uint64_t accesses[MEM_N_REGS];
+
+    for (uint32_t i = 0; i < MEM_N_REGS; i++) {
+        order[i] = i;
+        accesses[i] = reg_stats[i].reads.load(std::memory_order_relaxed) +
+                      reg_stats[i].writes.load(std::memory_order_relaxed);
+    }
+    std::stable_sort(order, order + MEM_N_REGS, [&accesses](uint32_t a, uint32_t b) {
+        return accesses[a] > accesses[b];
+    });
+
+    fprintf(out, "Register accesses\n");
+    fprintf(out, "%-12s %-10s %14s %14s %12s\n", "register", "address", "reads", "writes", "hook us");
+    for (uint32_t i : order) {
+        if (accesses[i] == 0) {
+            break;
+        }
+        fprintf(out, "%-12s 0x%08X %14llu %14llu %12.1f\n", reg_table[i].name, reg_table[i].addr,
+                (unsigned long long) reg_stats[i].reads.load(std::memory_order_relaxed),
+                (unsigned long long) reg_stats[i].writes.load(std::memory_order_relaxed),
+                reg_stats[i].hook_ns.load(std::memory_order_relaxed) / 1000.0);
+    }
 
+    const RegStats &unmapped = unmapped_stats();
+    if (unmapped.reads.load(std::memory_order_relaxed) + unmapped.writes.load(std::memory_order_relaxed) > 0) {
+        fprintf(out, "%-12s %-10s %14llu %14llu %12.1f\n", unmapped_desc.name, "",
+                (unsigned long long) unmapped.reads.load(std::memory_order_relaxed),
+                (unsigned long long) unmapped.writes.load(std::memory_order_relaxed),
+                unmapped.hook_ns.load(std::memory_order_relaxed) / 1000.0);
+    }
 
+    fprintf(out, "read callbacks %llu, write callbacks %llu, bus faults %llu\n",
+            (unsigned long long) mem_stats.rd_cb_calls.load(std::memory_order_relaxed),
+            (unsigned long long) mem_stats.wr_cb_calls.load(std::memory_order_relaxed),
+            (unsigned long long) mem_stats.bus_faults.load(std::memory_order_relaxed));
+}
 
+/**
+ * @brief Prints a coverage percentage
+ * @param out stream to print to
+ * @param covered bits covered
+ * @param total bits that can be covered
+ */
+static void print_coverage(FILE *out, uint32_t covered, uint32_t total) {
+    if (total == 0) {
+        fprintf(out, " %6s", "-");
+    } else {
+        fprintf(out, " %5.1f%%", 100.0 * covered / total);
+    }
+}
+
+void MemoryMap::coverage_report(FILE *out) const {
+    uint32_t total_rd = 0;
+    uint32_t total_wr = 0;
+    uint32_t covered_rd = 0;
+    uint32_t covered_w0 = 0;
+    uint32_t covered_w1 = 0;
+
+    fprintf(out, "Register bit coverage\n");
+    fprintf(out, "%-12s %-10s %-10s %-10s %-10s %7s %7s %7s\n", "register", "address", "read", "written 0",
+            "written 1", "read", "wr 0", "wr 1");
+    for (uint32_t i = 0; i < MEM_N_REGS; i++) {
+        const RegDesc &desc = reg_table[i];
+        uint32_t readable = ~desc.wo;
+        uint32_t writable = ~desc.ro;
+        uint32_t rd = reg_stats[i].read.load(std::memory_order_relaxed) & readable;
+        uint64_t written = reg_stats[i].written.load(std::memory_order_relaxed);
+        uint32_t w1 = (uint32_t) written & writable;
+        uint32_t w0 = (uint32_t) (written >> 32) & writable;
+
+        fprintf(out, "%-12s 0x%08X 0x%08X 0x%08X 0x%08X", desc.name, desc.addr, rd, w0, w1);
+        print_coverage(out, __builtin_popcount(rd), __builtin_popcount(readable));
+        print_coverage(out, __builtin_popcount(w0), __builtin_popcount(writable));
+        print_coverage(out, __builtin_popcount(w1), __builtin_popcount(writable));
+        fprintf(out, "\n");
+
+        total_rd += __builtin_popcount(readable);
+        total_wr += __builtin_popcount(writable);
+        covered_rd += __builtin_popcount(rd);
+        covered_w0 += __builtin_popcount(w0);
+        covered_w1 += __builtin_popcount(w1);
+    }
+
+    fprintf(out, "%-12s %-10s %-10s %-10s %-10s", "total", "", "", "", "");
+    print_coverage(out, covered_rd, total_rd);
+    print_coverage(out, covered_w0, total_wr);
+    print_coverage(out, covered_w1, total_wr);
+    fprintf(out, "\n");
+}
+
+void MemoryMap::reset_stats() {
+    for (RegStats &stats : reg_stats) {
+        stats.reads.store(0, std::memory_order_relaxed);
+        stats.writes.store(0, std::memory_order_relaxed);
+        stats.hook_ns.store(0, std::memory_order_relaxed);
+    }
+    unmapped_stats_data.reads.store(0, std::memory_order_relaxed);
+    unmapped_stats_data.writes.store(0, std::memory_order_relaxed);
+    unmapped_stats_data.hook_ns.store(0, std::memory_order_relaxed);
+}
+
+const RegStats &MemoryMap::unmapped_stats() const {
+    return unmapped_stats_data;
+}
+
+/**
+ * @brief Changes a watchpoint slot, hook_mutex held
+ * @param slot slot to change
+ * @param watch new contents
+ */
+static void watch_store(WatchSlot &slot, const Watchpoint &watch) {
+    /* Odd while the fields change, the accesses skip the slot */
+    slot.seq.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.first.store(watch.first, std::memory_order_relaxed);
+    slot.last.store(watch.last, std::memory_order_relaxed);
+    slot.mask.store(watch.mask, std::memory_order_relaxed);
+    slot.on_read.store(watch.on_read, std::memory_order_relaxed);
+    slot.on_write.store(watch.on_write, std::memory_order_relaxed);
+    slot.action.store(watch.action, std::memory_order_relaxed);
+    slot.cb.store(watch.cb, std::memory_order_relaxed);
+    slot.hits.store(watch.hits, std::memory_order_relaxed);
+    slot.used.store(watch.used, std::memory_order_relaxed);
+    slot.seq.fetch_add(1, std::memory_order_release);
+}
+
+/**
+ * @brief Takes a consistent copy of a watchpoint slot without locks
+ * @param slot slot to read
+ * @param watch copy of the slot
+ * @return true if the slot is in use and did not change while it was copied
+ */
+static bool watch_load(const WatchSlot &slot, Watchpoint &watch) {
+    uint32_t seq = slot.seq.load(std::memory_order_acquire);
+
+    if ((seq & 1) || !slot.used.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    watch.used = true;
+    watch.first = slot.first.load(std::memory_order_relaxed);
+    watch.last = slot.last.load(std::memory_order_relaxed);
+    watch.mask = slot.mask.load(std::memory_order_relaxed);
+    watch.on_read = slot.on_read.load(std::memory_order_relaxed);
+    watch.on_write = slot.on_write.load(std::memory_order_relaxed);
+    watch.action = slot.action.load(std::memory_order_relaxed);
+    watch.cb = slot.cb.load(std::memory_order_relaxed);
+    watch.hits = slot.hits.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.seq.load(std::memory_order_relaxed) == seq;
+}
+
+int MemoryMap::add_watch(uint32_t first, uint32_t last, uint32_t mask, bool on_read, bool on_write,
+                         WatchAction action, watch_func cb) {
+    std::lock_guard<std::mutex> lock(hook_mutex);
+
+    for (int i = 0; i < MEM_MAX_WATCHES; i++) {
+        if (!watches[i].used.load(std::memory_order_relaxed)) {
+            watch_store(watches[i], {true, first, last, mask, on_read, on_write, action, cb, 0});
+            update_page_hooks();
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool MemoryMap::remove_watch(int id) {
+    std::lock_guard<std::mutex> lock(hook_mutex);
+
+    if ((id < 0) || (id >= MEM_MAX_WATCHES) || !watches[id].used.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    watch_store(watches[id], {});
+    update_page_hooks();
+    return true;
+}
+
+bool MemoryMap::get_watch(int id, Watchpoint &watch) const {
+    if ((id < 0) || (id >= MEM_MAX_WATCHES)) {
+        return false;
+    }
+    return watch_load(watches[id], watch);
+}
+
+bool MemoryMap::paused() const {
+    return watch_paused.load(std::memory_order_relaxed) != 0;
+}
+
+void MemoryMap::resume() {
+    resume_func cb = watch_resume_cb.load(std::memory_order_acquire);
+
+    if (cb != nullptr) {
+        cb();
+    }
+}
+
+void MemoryMap::set_pause(pause_func pause_cb, resume_func resume_cb) {
+    watch_resume_cb.store(resume_cb, std::memory_order_release);
+    watch_pause_cb.store(pause_cb, std::memory_order_release);
+}
+
+/**
+ * @brief Sets a flag on the pages with registers in a range
+ * @param pages page flags
+ * @param first first address
+ * @param last last address
+ * @param flag PAGE_* flag to set
+ */
+static void flag_pages(uint8_t *pages, uint32_t first, uint32_t last, uint8_t flag) {
+    for (const RegDesc &desc : reg_table) {
+        if ((desc.addr >= first) && (desc.addr <= last)) {
+            pages[desc.addr >> MEM_PAGE_SHIFT] |= flag;
+        }
+    }
+}
+
+void MemoryMap::update_page_hooks() {
+    uint8_t pages[MEM_PAGES] = {};
+
+    for (const WatchSlot &w : watches) {
+        if (w.used.load(std::memory_order_relaxed)) {
+            flag_pages(pages, w.first.load(std::memory_order_relaxed), w.last.load(std::memory_order_relaxed),
+                       PAGE_WATCHED);
+        }
+    }
+
+    for (const Subscription &sub : subscriptions) {
+        if (sub.queue.load(std::memory_order_relaxed)) {
+            flag_pages(pages, sub.first.load(std::memory_order_relaxed), sub.last.load(std::memory_order_relaxed),
+                       PAGE_SUBSCRIBED);
+        }
+    }
+
+    if (shm_exported) {
+        flag_pages(pages, 0, 0xFFFFFFFF, PAGE_SHARED);
+    }
+
+    for (uint32_t i = 0; i < MEM_PAGES; i++) {
+        page_hooks[i].store(pages[i], std::memory_order_relaxed);
+    }
+}
+
+int MemoryMap::subscribe(uint32_t first, uint32_t last, uint32_t mask, RegQueue *queue) {
+    std::lock_guard<std::mutex> lock(hook_mutex);
+
+    if (queue == nullptr) {
+        return -1;
+    }
+
+    for (int i = 0; i < MEM_MAX_SUBSCRIPTIONS; i++) {
+        Subscription &sub = subscriptions[i];
+
+        if (sub.queue.load(std::memory_order_relaxed) == nullptr) {
+            sub.first.store(first, std::memory_order_relaxed);
+            sub.last.store(last, std::memory_order_relaxed);
+            sub.mask.store(mask, std::memory_order_relaxed);
+            sub.queue.store(queue, std::memory_order_release);
+            update_page_hooks();
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool MemoryMap::unsubscribe(int id) {
+    std::lock_guard<std::mutex> lock(hook_mutex);
+
+    if ((id < 0) || (id >= MEM_MAX_SUBSCRIPTIONS) ||
+        (subscriptions[id].queue.load(std::memory_order_relaxed) == nullptr)) {
+        return false;
+    }
+    subscriptions[id].queue.store(nullptr, std::memory_order_release);
+    update_page_hooks();
+    return true;
+}
+
+void MemoryMap::notify_subscribers(uint32_t idx, uint32_t old_val, uint32_t new_val) {
+    uint32_t addr = reg_table[idx].addr;
+
+    for (Subscription &sub : subscriptions) {
+        RegQueue *queue = sub.queue.load(std::memory_order_acquire);
+
+        if ((queue != nullptr) && (addr >= sub.first.load(std::memory_order_relaxed)) &&
+            (addr <= sub.last.load(std::memory_order_relaxed)) &&
+            ((old_val ^ new_val) & sub.mask.load(std::memory_order_relaxed))) {
+            queue->push(idx);
+        }
+    }
+}
+
+RegQueue::RegQueue() : pending(), tail(0), head(0) {
+    for (std::atomic<int16_t> &slot : ring) {
+        slot.store(-1, std::memory_order_relaxed);
+    }
+}
+
+void RegQueue::push(uint32_t idx) {
+    uint64_t bit = 1ULL << (idx % 64);
+
+    /* Already queued, the observer will read the latest value */
+    if (pending[idx / 64].fetch_or(bit, std::memory_order_acq_rel) & bit) {
+        return;
+    }
+
+    uint32_t pos = tail.fetch_add(1, std::memory_order_relaxed);
+    ring[pos % RING_SIZE].store((int16_t) idx, std::memory_order_release);
+}
+
+bool RegQueue::pop(RegChange &change) {
+    std::atomic<int16_t> &slot = ring[head % RING_SIZE];
+    int16_t idx = slot.load(std::memory_order_acquire);
+
+    if (idx < 0) {
+        return false;
+    }
+    slot.store(-1, std::memory_order_relaxed);
+    head++;
+
+    /* Clear before reading, so a later change queues a new notification */
+    pending[idx / 64].fetch_and(~(1ULL << (idx % 64)), std::memory_order_acq_rel);
+    change.addr = reg_table[idx].addr;
+    change.value = reg_data[idx].load(std::memory_order_acquire);
+    return true;
+}
+
+uint32_t MemoryMap::sync_direct() {
+    uint32_t changed = 0;
+
+    for (uint32_t i = 0; i < MEM_N_REGS; i++) {
+        if (!reg_direct(i)) {
+            continue;
+        }
+
+        uint32_t val = reg_data[i].load(std::memory_order_acquire);
+        uint32_t old_val = direct_shadow[i].exchange(val, std::memory_order_relaxed);
+
+        if (old_val != val) {
+            uint8_t hooks = page_hooks[reg_table[i].addr >> MEM_PAGE_SHIFT].load(std::memory_order_relaxed);
+
+            changed++;
+            /* Only the bits that changed are known to have been written */
+            reg_stats[i].cover_write(val & ~old_val, old_val & ~val);
+            if (hooks & PAGE_SHARED) {
+                /* Direct write already done, only tell the readers it happened */
+                mem_seq_lock(reg_table[i].addr);
+                mem_seq_unlock(reg_table[i].addr);
+            }
+            if (hooks & PAGE_WATCHED) {
+                watch_hit(&reg_table[i], old_val, val, true, true);
+            }
+            if (hooks & PAGE_SUBSCRIBED) {
+                notify_subscribers(i, old_val, val);
+            }
+        }
+    }
+    return changed;
+}
+
+void MemoryMap::page_hit(const RegDesc *desc, uint32_t old_val, uint32_t new_val, bool write, bool firmware) {
+    int idx = reg_index(desc->addr);
+    uint8_t hooks = page_hooks[desc->addr >> MEM_PAGE_SHIFT].load(std::memory_order_relaxed);
+
+    if (idx < 0) {
+        return;
+    }
+
+    /* Reported now, sync_direct() must not see this change again */
+    if (write && reg_direct(idx)) {
+        direct_shadow[idx].store(new_val, std::memory_order_relaxed);
+    }
+
+    if (firmware && (hooks & PAGE_WATCHED)) {
+        watch_hit(desc, old_val, new_val, write);
+    }
+    if (write && (hooks & PAGE_SUBSCRIBED)) {
+        notify_subscribers(idx, old_val, new_val);
+    }
+}
+
+void MemoryMap::watch_hit(const RegDesc *desc, uint32_t old_val, uint32_t new_val, bool write, bool deferred) {
+    for (int i = 0; i < MEM_MAX_WATCHES; i++) {
+        Watchpoint w;
+
+        if (!watch_load(watches[i], w) || (desc->addr < w.first) || (desc->addr > w.last)) {
+            continue;
+        }
+        if (write ? !(w.on_write && ((old_val ^ new_val) & w.mask)) : !w.on_read) {
+            continue;
+        }
+
+        watches[i].hits.fetch_add(1, std::memory_order_relaxed);
+        switch (w.action) {
+            case WatchAction::Count:
+                break;
+            case WatchAction::Callback:
+                if (w.cb) {
+                    w.cb(desc->addr, old_val, new_val, write);
+                }
+                break;
+            case WatchAction::Pause: {
+                pause_func pause = watch_pause_cb.load(std::memory_order_acquire);
+
+                if (deferred || (pause == nullptr)) {
+                    printf("Watch %d: %s %s 0x%08X -> 0x%08X, cannot pause\n", i,
+                           deferred ? "direct write" : (write ? "write" : "read"), desc->name, old_val, new_val);
+                    break;
+                }
+                printf("Watch %d: %s %s 0x%08X -> 0x%08X, paused\n", i, write ? "write" : "read", desc->name,
+                       old_val, new_val);
+                watch_paused.fetch_add(1, std::memory_order_relaxed);
+                bool stopped = pause();
+                watch_paused.fetch_sub(1, std::memory_order_relaxed);
+                if (!stopped) {
+                    printf("Watch %d: not accessed from a firmware task, cannot pause\n", i);
+                }
+                break;
+            }
+            case WatchAction::Log:
+            default:
+                printf("Watch %d: %s %s 0x%08X -> 0x%08X\n", i, write ? "write" : "read", desc->name,
+                       old_val, new_val);
+                break;
+        }
+    }
+}
+
+void mem_page_hit(const RegDesc *desc, uint32_t old_val, uint32_t new_val, bool write, bool firmware) {
+    memory.page_hit(desc, old_val, new_val, write, firmware);
+}
+
+bool MemoryMap::export_shm(const char *name) {
+    std::lock_guard<std::mutex> lock(hook_mutex);
+
+    if (shm_exported) {
+        printf("Memory: register file already exported as %s\n", shm_name);
+        return false;
+    }
+
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if ((fd < 0) || (ftruncate(fd, REG_SHM_SIZE) != 0)) {
+        printf("Memory: cannot create shared memory %s\n", name);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    void *hdr_page = mmap(nullptr, REG_SHM_SIZE - REG_SHM_HDR_OFFSET, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                          REG_SHM_HDR_OFFSET);
+    if (hdr_page == MAP_FAILED) {
+        printf("Memory: cannot map shared memory %s\n", name);
+        close(fd);
+        return false;
+    }
+
+    /* Replace the register file page in place, so its address does not change */
+    uint32_t saved[MEM_N_REGS];
+    for (uint32_t i = 0; i < MEM_N_REGS; i++) {
+        saved[i] = reg_data[i].load(std::memory_order_acquire);
+    }
+    if (mmap(reg_data, sizeof(reg_data), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+             REG_SHM_REGS_OFFSET) == MAP_FAILED) {
+        printf("Memory: cannot map the register file to %s\n", name);
+        munmap(hdr_page, REG_SHM_SIZE - REG_SHM_HDR_OFFSET);
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    for (uint32_t i = 0; i < MEM_REG_FILE_WORDS; i++) {
+        reg_data[i].store(i < MEM_N_REGS ? saved[i] : 0, std::memory_order_relaxed);
+    }
+
+    memset(hdr_page, 0, REG_SHM_SIZE - REG_SHM_HDR_OFFSET);
+    auto *hdr = (reg_shm_header_t *) hdr_page;
+    uint32_t seq_offset = REG_SHM_HDR_OFFSET + 64;
+    uint32_t desc_offset = seq_offset + MEM_PAGES * sizeof(uint32_t);
+    static_assert(REG_SHM_HDR_OFFSET + 64 + MEM_PAGES * sizeof(uint32_t) + MEM_N_REGS * sizeof(reg_shm_desc_t) <=
+                  REG_SHM_SIZE, "shared memory layout does not fit");
+
+    auto *desc = (reg_shm_desc_t *) ((uint8_t *) hdr_page + desc_offset - REG_SHM_HDR_OFFSET);
+    for (uint32_t i = 0; i < MEM_N_REGS; i++) {
+        desc[i].addr = reg_table[i].addr;
+        strncpy(desc[i].name, reg_table[i].name, REG_SHM_NAME_LEN - 1);
+    }
+
+    hdr->version = REG_SHM_VERSION;
+    hdr->n_regs = MEM_N_REGS;
+    hdr->n_blocks = MEM_PAGES;
+    hdr->block_shift = MEM_PAGE_SHIFT;
+    hdr->seq_offset = seq_offset;
+    hdr->desc_offset = desc_offset;
+    /* Readers check the magic last */
+    __atomic_store_n(&hdr->magic, REG_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    page_seq = (std::atomic<uint32_t> *) ((uint8_t *) hdr_page + seq_offset - REG_SHM_HDR_OFFSET);
+    snprintf(shm_name, sizeof(shm_name), "%s", name);
+    shm_exported = true;
+    update_page_hooks();
+    return true;
+}
+
+void MemoryMap::unlink_shm() {
+    std::lock_guard<std::mutex> lock(hook_mutex);
+
+    if (shm_exported) {
+        shm_unlink(shm_name);
+    }
+}
+
+void MemoryMap::set_shm_guard(shm_guard_func enter, shm_guard_func exit) {
+    seq_exit.store(exit, std::memory_order_release);
+    seq_enter.store(enter, std::memory_order_release);
+}
+
+void mem_seq_lock(uint32_t addr) {
+    std::atomic<uint32_t> &seq = page_seq[addr >> MEM_PAGE_SHIFT];
+    shm_guard_func enter = seq_enter.load(std::memory_order_acquire);
+
+    /* The holder of an odd counter always runs, the spin below ends */
+    if (enter != nullptr) {
+        enter();
+    }
+
+    uint32_t val = seq.load(std::memory_order_relaxed);
+
+    /* Writers of the same block exclude each other, an odd value is taken */
+    while ((val & 1) || !seq.compare_exchange_weak(val, val + 1, std::memory_order_acquire,
+                                                   std::memory_order_relaxed)) {
+        val = seq.load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void mem_seq_unlock(uint32_t addr) {
+    shm_guard_func exit = seq_exit.load(std::memory_order_acquire);
+
+    page_seq[addr >> MEM_PAGE_SHIFT].fetch_add(1, std::memory_order_release);
+    if (exit != nullptr) {
+        exit();
+    }
+}
+
+void MemoryMap::set_bus_fault(BusFault action, bus_fault_func irq_cb) {
+    fault_irq_cb.store(irq_cb, std::memory_order_release);
+    fault_action.store(action, std::memory_order_release);
+}
+
+void MemoryMap::bus_fault(uint32_t addr, bool write) {
+    mem_stats.bus_faults.fetch_add(1, std::memory_order_relaxed);
+
+    switch (fault_action.load(std::memory_order_acquire)) {
+        case BusFault::Irq: {
+            bus_fault_func cb = fault_irq_cb.load(std::memory_order_acquire);
+            if (cb) {
+                cb(addr, write);
+            }
+            break;
+        }
+        case BusFault::Abort:
+            printf("Bus fault: %s at 0x%08X\n", write ? "write" : "read", addr);
+            abort();
+        case BusFault::Log:
+        default:
+            printf("Bus fault: %s at 0x%08X\n", write ? "write" : "read", addr);
+            break;
+    }
+}
+
+/**
+ * MCU memory
+ */
+MemoryMap memory;
@@ -9,10 +9,13 @@
 #define PRAC1_MEMORY_H
 
 #include <cstdint>
-#include <unordered_map>
-#include <functional>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <array>
+#include <iterator>
 #include <iostream>
-#include <utility>
 
 enum {
     ADDR_PORTA_CTRL  = 0x01000,
@@ -33,6 +36,11 @@ enum {
     ADDR_PORTD_IN    = 0x0400C,
     ADDR_NVIC_CTRL   = 0x0A000,
     ADDR_NVIC_IRQ    = 0x0A004,
+    ADDR_NVIC_ACTIVE = 0x0A008,
+    ADDR_NVIC_PRIO0  = 0x0A00C,
+    ADDR_NVIC_PRIO1  = 0x0A010,
+    ADDR_NVIC_PRIO2  = 0x0A014,
+    ADDR_NVIC_PRIO3  = 0x0A018,
     ADDR_I2C0_CTRL   = 0x0B000,
     ADDR_TIMER_CTRL  = 0x0C000,
     ADDR_TIMER_TOP   = 0x0C004,
@@ -52,116 +60,1320 @@ enum {
     ADDR_ADC_CTRL    = 0x30004,
     ADDR_ADC_DATA    = 0x30008,
     ADDR_ADC_STATUS  = 0x3000C,
+    ADDR_PWR_WAKE    = 0x40000,
+    ADDR_PWR_RUN     = 0x40004,
+    ADDR_PWR_SLEEP   = 0x40008,
+    ADDR_PWR_DEEP    = 0x4000C,
     ADDR_WDOG_CTRL   = 0x80000,
     ADDR_WDOG_CMD    = 0x80004,
+    ADDR_FLASH_BASE  = 0x08000000,
+    ADDR_SRAM_BASE   = 0x20000000,
 };
 
 /**
- * @brief definition of callback function type
+ * @brief definition of read callback function type
+ *
+ * Receives the stored value and the register parameter, returns the value
+ * seen by the reader.
  */
-using cb_func = std::function<uint32_t(uint32_t, uint32_t)>;
+using cb_func = uint32_t (*)(uint32_t, uint32_t);
 
-struct WordMem {
-    WordMem() :
-            data(0), param_rd(0), param_wr(0), cb_rd(nullptr), cb_wr(nullptr) {
+/**
+ * @brief definition of write callback function type
+ *
+ * Receives the value before the write, the value after the write and the
+ * register parameter.
+ */
+using wr_cb_func = uint32_t (*)(uint32_t, uint32_t, uint32_t);
+
+/* Register callbacks, implemented by the peripheral models in SoC.cpp */
+
+/**
+ * @brief write callback for PORTx_IN registers, triggers GPIO IRQs
+ * @param old_val PORT input value before the change
+ * @param val PORT input value after the change
+ * @param param PORT that has a change (1 to 4)
+ */
+uint32_t GPIO_in_cb(uint32_t old_val, uint32_t val, uint32_t param);
+
+/**
+ * @brief write callback for NVIC_IRQ register, wakes up the tasks sleeping until an IRQ and dispatches the ISRs
+ * @param old_val pending IRQs before the write
+ * @param val pending IRQs after the write
+ * @param param unused
+ */
+uint32_t NVIC_IRQ_cb(uint32_t old_val, uint32_t val, uint32_t param);
+
+/**
+ * @brief write callback for NVIC_CTRL and NVIC_PRIOx registers, dispatches the ISRs that may run now
+ * @param old_val unused
+ * @param val unused
+ * @param param unused
+ */
+uint32_t NVIC_CTRL_cb(uint32_t old_val, uint32_t val, uint32_t param);
+
+/**
+ * @brief write callback for TRACE register
+ * @param old_val unused
+ * @param val character written
+ * @param param unused
+ */
+uint32_t Trace_cb(uint32_t old_val, uint32_t val, uint32_t param);
+
+/**
+ * @brief write callback for UART_TXDATA register
+ * @param old_value unused
+ * @param value frame to send
+ * @param uart unused
+ */
+uint32_t send_to_uart(uint32_t old_value, uint32_t value, uint32_t uart);
+
+/**
+ * @brief read callback for ADC data register
+ * @param val unused
+ * @param param unused
+ */
+uint32_t ADC_data_cb(uint32_t val, uint32_t param);
+
+/**
+ * @brief write callback for TIMER_CTRL, TIMER_TOP and TIMER_CMP registers, restarts the count on configuration
+ * changes and moves the compare and overflow events
+ * @param old_val unused
+ * @param val unused
+ * @param param unused
+ */
+uint32_t TIMER_cb(uint32_t old_val, uint32_t val, uint32_t param);
+
+/**
+ * @brief read callback for TIMER_CNT register, computes the count from the virtual time
+ * @param val unused
+ * @param param unused
+ */
+uint32_t TIMER_rd_cb(uint32_t val, uint32_t param);
+
+/**
+ * @brief write callback for RTC_CTRL and RTC_CMP registers, starts or stops the count and moves the compare match
+ * @param old_val unused
+ * @param val unused
+ * @param param unused
+ */
+uint32_t RTC_cb(uint32_t old_val, uint32_t val, uint32_t param);
+
+/**
+ * @brief write callback for RTC_CNT register, the count goes on from the value written
+ * @param old_val unused
+ * @param val value written
+ * @param param unused
+ */
+uint32_t RTC_set_cb(uint32_t old_val, uint32_t val, uint32_t param);
+
+/**
+ * @brief read callback for RTC_CNT register, computes the count from the virtual time
+ * @param val unused
+ * @param param unused
+ */
+uint32_t RTC_rd_cb(uint32_t val, uint32_t param);
+
+/**
+ * @brief  write callback for WDT_CTRL register
+ * @param old_val unused
+ * @param val unused
+ * @param param unused
+ */
+uint32_t WDT_cb(uint32_t old_val, uint32_t val, uint32_t param);
+
+/**
+ * @brief write callback for WDT_CMD register
+ * @param old_val unused
+ * @param val value written
+ * @param param unused
+ */
+uint32_t WDT_feed_cb(uint32_t old_val, uint32_t val, uint32_t param);
+
+/**
+ * @brief read callback for PWR_RUN, PWR_SLEEP and PWR_DEEP registers, ms spent in a power mode
+ * @param val unused
+ * @param param power mode
+ */
+uint32_t PWR_rd_cb(uint32_t val, uint32_t param);
+
+/**
+ * @brief Register description
+ *
+ * Access masks only apply to firmware accesses (WordMem operators), the
+ * peripheral models use the hw_* operations to update read-only bits.
+ */
+struct RegDesc {
+    const char *name;   /**< Register name, for reports */
+    uint32_t addr;      /**< Register address */
+    uint32_t reset;     /**< Value after reset */
+    uint32_t ro;        /**< Read-only bits, firmware writes do not change them */
+    uint32_t wo;        /**< Write-only bits, firmware reads return 0 */
+    uint32_t w1c;       /**< Write-1-to-clear bits */
+    cb_func cb_rd;      /**< function to call when memory read */
+    wr_cb_func cb_wr;   /**< function to call when memory written */
+    uint32_t param;     /**< parameter to send to the callbacks */
+
+    /**
+     * @brief Checks if firmware writes need the access masks
+     */
+    constexpr bool write_masked() const {
+        return (ro | w1c) != 0;
     }
 
-    WordMem &operator=(uint32_t val) {
-        data = val;
+    /**
+     * @brief Computes the register value after a firmware write
+     * @param old_val register value before the write
+     * @param val value written by the firmware
+     * @return new register value
+     */
+    constexpr uint32_t bus_write(uint32_t old_val, uint32_t val) const {
+        return (old_val & ro) | (old_val & w1c & ~val) | (val & ~(ro | w1c));
+    }
+};
+
+/**
+ * @brief Register table, sorted by address
+ *
+ * Registers of a peripheral must be consecutive words starting at the
+ * beginning of a 4 KB page. The address decoder and the register storage are
+ * generated from this table at compile time.
+ */
+inline constexpr RegDesc reg_table[] = {
+    /* name              address           reset  RO          WO          W1C         read cb      write cb      param */
+    {"PORTA_CTRL",       ADDR_PORTA_CTRL,  0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"PORTA_INT",        ADDR_PORTA_INT,   0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"PORTA_OUT",        ADDR_PORTA_OUT,   0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"PORTA_IN",         ADDR_PORTA_IN,    0,     0xFFFFFFFF, 0,          0,          nullptr,     GPIO_in_cb,   1},
+    {"PORTB_CTRL",       ADDR_PORTB_CTRL,  0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"PORTB_INT",        ADDR_PORTB_INT,   0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"PORTB_OUT",        ADDR_PORTB_OUT,   0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"PORTB_IN",         ADDR_PORTB_IN,    0,     0xFFFFFFFF, 0,          0,          nullptr,     GPIO_in_cb,   2},
+    {"PORTC_CTRL",       ADDR_PORTC_CTRL,  0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"PORTC_INT",        ADDR_PORTC_INT,   0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"PORTC_OUT",        ADDR_PORTC_OUT,   0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"PORTC_IN",         ADDR_PORTC_IN,    0,     0xFFFFFFFF, 0,          0,          nullptr,     GPIO_in_cb,   3},
+    {"PORTD_CTRL",       ADDR_PORTD_CTRL,  0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"PORTD_INT",        ADDR_PORTD_INT,   0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"PORTD_OUT",        ADDR_PORTD_OUT,   0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"PORTD_IN",         ADDR_PORTD_IN,    0,     0xFFFFFFFF, 0,          0,          nullptr,     GPIO_in_cb,   4},
+    {"NVIC_CTRL",        ADDR_NVIC_CTRL,   0xFFFFFFFF, 0,     0,          0,          nullptr,     NVIC_CTRL_cb, 0},
+    {"NVIC_IRQ",         ADDR_NVIC_IRQ,    0,     0,          0,          0,          nullptr,     NVIC_IRQ_cb,  0},
+    {"NVIC_ACTIVE",      ADDR_NVIC_ACTIVE, 0,     0xFFFFFFFF, 0,          0,          nullptr,     nullptr,      0},
+    {"NVIC_PRIO0",       ADDR_NVIC_PRIO0,  0,     0,          0,          0,          nullptr,     NVIC_CTRL_cb, 0},
+    {"NVIC_PRIO1",       ADDR_NVIC_PRIO1,  0,     0,          0,          0,          nullptr,     NVIC_CTRL_cb, 0},
+    {"NVIC_PRIO2",       ADDR_NVIC_PRIO2,  0,     0,          0,          0,          nullptr,     NVIC_CTRL_cb, 0},
+    {"NVIC_PRIO3",       ADDR_NVIC_PRIO3,  0,     0,          0,          0,          nullptr,     NVIC_CTRL_cb, 0},
+    {"I2C0_CTRL",        ADDR_I2C0_CTRL,   0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"TIMER_CTRL",       ADDR_TIMER_CTRL,  0,     0,          0,          0,          nullptr,     TIMER_cb,     0},
+    {"TIMER_TOP",        ADDR_TIMER_TOP,   0,     0,          0,          0,          nullptr,     TIMER_cb,     0},
+    {"TIMER_CNT",        ADDR_TIMER_CNT,   0,     0xFFFFFFFF, 0,          0,          TIMER_rd_cb, nullptr,      0},
+    {"TIMER_CMP",        ADDR_TIMER_CMP,   0,     0,          0,          0,          nullptr,     TIMER_cb,     0},
+    {"RTC_CTRL",         ADDR_RTC_CTRL,    0,     0,          0,          0,          nullptr,     RTC_cb,       0},
+    {"RTC_CNT",          ADDR_RTC_CNT,     0,     0,          0,          0,          RTC_rd_cb,   RTC_set_cb,   0},
+    {"RTC_CMP",          ADDR_RTC_CMP,     0,     0,          0,          0,          nullptr,     RTC_cb,       0},
+    {"TRACE",            ADDR_TRACE,       0,     0,          0,          0,          nullptr,     Trace_cb,     0},
+    {"DAC_CTRL",         ADDR_DAC_CTRL,    0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"DAC_DATA",         ADDR_DAC_DATA,    0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"UART_CTRL",        ADDR_UART_CTRL,   0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"UART_STATUS",      ADDR_UART_STATUS, 0,     0xFFFFFFFF, 0,          0,          nullptr,     nullptr,      0},
+    {"UART_TXDATA",      ADDR_UART_TXDATA, 0,     0,          0xFFFFFFFF, 0,          nullptr,     send_to_uart, 0},
+    {"UART_RXDATA",      ADDR_UART_RXDATA, 0,     0xFFFFFFFF, 0,          0,          nullptr,     nullptr,      0},
+    {"ADC_ADMUX",        ADDR_ADC_ADMUX,   0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"ADC_CTRL",         ADDR_ADC_CTRL,    0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"ADC_DATA",         ADDR_ADC_DATA,    0,     0xFFFFFFFF, 0,          0,          ADC_data_cb, nullptr,      0},
+    {"ADC_STATUS",       ADDR_ADC_STATUS,  0,     0xFFFFFFFF, 0,          0,          nullptr,     nullptr,      0},
+    {"PWR_WAKE",         ADDR_PWR_WAKE,    0,     0,          0,          0,          nullptr,     nullptr,      0},
+    {"PWR_RUN",          ADDR_PWR_RUN,     0,     0xFFFFFFFF, 0,          0,          PWR_rd_cb,   nullptr,      0},
+    {"PWR_SLEEP",        ADDR_PWR_SLEEP,   0,     0xFFFFFFFF, 0,          0,          PWR_rd_cb,   nullptr,      1},
+    {"PWR_DEEP",         ADDR_PWR_DEEP,    0,     0xFFFFFFFF, 0,          0,          PWR_rd_cb,   nullptr,      2},
+    {"WDOG_CTRL",        ADDR_WDOG_CTRL,   0,     0,          0,          0,          nullptr,     WDT_cb,       0},
+    {"WDOG_CMD",         ADDR_WDOG_CMD,    0,     0,          0xFFFFFFFF, 0,          nullptr,     WDT_feed_cb,  0},
+};
+
+/** Number of registers in #reg_table */
+#define MEM_N_REGS (std::size(reg_table))
+
+/** Page size of the address decoder is 4 KB */
+#define MEM_PAGE_SHIFT (12)
+
+/** Number of pages covered by the address decoder (1 MB address space) */
+#define MEM_PAGES (0x100000 >> MEM_PAGE_SHIFT)
+
+/** Words of the register file, a full page so it can be remapped to shared memory */
+#define MEM_REG_FILE_WORDS (4096 / sizeof(uint32_t))
+
+static_assert(MEM_N_REGS <= MEM_REG_FILE_WORDS, "reg_table does not fit in the register file page");
+
+/**
+ * @brief Register storage, same order as #reg_table
+ *
+ * The peripheral structs of Registers.h overlay it through reg_file. Page
+ * aligned, so MemoryMap::export_shm() can map it to a shared memory segment
+ * without changing its address.
+ */
+extern std::atomic<uint32_t> reg_data[MEM_REG_FILE_WORDS];
+
+static_assert((sizeof(std::atomic<uint32_t>) == sizeof(uint32_t)) &&
+              (alignof(std::atomic<uint32_t>) == alignof(uint32_t)) &&
+              std::atomic<uint32_t>::is_always_lock_free,
+              "reg_data must have the layout of a plain uint32_t array");
+
+/** Set to 0 to build without the per-register access counters */
+#ifndef MEM_PROFILE
+#define MEM_PROFILE 1
+#endif
+
+/** Set to 0 to build without the register bit coverage */
+#ifndef MEM_COVERAGE
+#define MEM_COVERAGE 1
+#endif
+
+/**
+ * @brief Access counters and bit coverage of a register
+ *
+ * Counters are updated with a relaxed load and store instead of a locked
+ * read-modify-write, so counting stays a couple of instructions. Only one
+ * FreeRTOS task runs at a time, an increment can only be lost when the GUI
+ * or UART thread accesses the same register at the same time. Coverage is
+ * accumulated the same way with one OR per access.
+ */
+struct RegStats {
+    std::atomic<uint64_t> reads;    /**< firmware reads */
+    std::atomic<uint64_t> writes;   /**< firmware writes and read-modify-writes */
+    std::atomic<uint64_t> hook_ns;  /**< time spent in the register callbacks */
+    std::atomic<uint64_t> written;  /**< bits written as 1 (31:0) and as 0 (63:32) */
+    std::atomic<uint32_t> read;     /**< bits read */
+
+    void count_read() {
+        if constexpr (MEM_PROFILE) {
+            reads.store(reads.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+
+    void count_write() {
+        if constexpr (MEM_PROFILE) {
+            writes.store(writes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Adds bits to the read coverage
+     * @param bits bits returned to the firmware
+     */
+    void cover_read(uint32_t bits) {
+        if constexpr (MEM_COVERAGE) {
+            read.store(read.load(std::memory_order_relaxed) | bits, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Adds bits to the write coverage
+     * @param ones bits written as 1
+     * @param zeros bits written as 0
+     */
+    void cover_write(uint32_t ones, uint32_t zeros) {
+        if constexpr (MEM_COVERAGE) {
+            written.store(written.load(std::memory_order_relaxed) | ((uint64_t) zeros << 32) | ones,
+                          std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Calls a register callback and adds its duration to hook_ns
+     * @param hook callback invocation
+     * @return value returned by the callback
+     */
+    template<typename F>
+    uint32_t time_hook(F hook) {
+        if constexpr (MEM_PROFILE) {
+            auto start = std::chrono::steady_clock::now();
+            uint32_t ret_val = hook();
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            hook_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                              std::memory_order_relaxed);
+            return ret_val;
+        } else {
+            return hook();
+        }
+    }
+};
+
+/**
+ * @brief Access counters, same order as #reg_table
+ */
+extern RegStats reg_stats[MEM_N_REGS];
+
+/**
+ * @brief Callback statistics of the memory map
+ */
+struct MemStats {
+    std::atomic<uint64_t> rd_cb_calls;  /**< read callbacks called */
+    std::atomic<uint64_t> wr_cb_calls;  /**< write callbacks called */
+    std::atomic<uint64_t> bus_faults;   /**< accesses to unmapped addresses */
+};
+
+/**
+ * @brief Callback statistics of the memory map
+ */
+extern MemStats mem_stats;
+
+/** Page has watchpoints */
+#define PAGE_WATCHED    (0x01)
+/** Page has change subscriptions */
+#define PAGE_SUBSCRIBED (0x02)
+/** Page is exported to shared memory, writes take its sequence lock */
+#define PAGE_SHARED     (0x04)
+
+/**
+ * @brief PAGE_* flags of each page, indexed by addr >> MEM_PAGE_SHIFT
+ */
+extern std::atomic<uint8_t> page_hooks[MEM_PAGES];
+
+/**
+ * @brief Handles an access to a register on a page with watchpoints or subscriptions
+ * @param desc register accessed
+ * @param old_val value before the access
+ * @param new_val value after the access, same as old_val on reads
+ * @param write true on write accesses
+ * @param firmware true for firmware accesses, false for the hw_* operations
+ */
+void mem_page_hit(const RegDesc *desc, uint32_t old_val, uint32_t new_val, bool write, bool firmware);
+
+/**
+ * @brief definition of the shared memory writer guard type, see MemoryMap::set_shm_guard()
+ */
+using shm_guard_func = void (*)();
+
+/**
+ * @brief Takes the sequence lock of the shared memory block of a register
+ *
+ * Enters the writer guard first, so a task is never switched out with the
+ * counter odd while another writer of the block spins on it.
+ * @param addr register address
+ */
+void mem_seq_lock(uint32_t addr);
 
-        if (cb_wr) {
-            cb_wr(val, param_wr);
+/**
+ * @brief Releases the sequence lock of the shared memory block of a register, then the writer guard
+ * @param addr register address
+ */
+void mem_seq_unlock(uint32_t addr);
+
+/**
+ * @brief Access to a 32 bit register
+ *
+ * Small handle to the register storage and its description. Storage is
+ * atomic so FreeRTOS tasks, the GUI thread and the UART reader thread can
+ * access the same register concurrently. When the address is known at compile
+ * time the description is folded away and registers without callbacks or
+ * masks become a plain load or store.
+ */
+class WordMem {
+public:
+    constexpr WordMem(std::atomic<uint32_t> *p_data, const RegDesc *p_desc, RegStats *p_stats) :
+            data(p_data), desc(p_desc), stats(p_stats) {
+    }
+
+    WordMem &operator=(uint32_t val) {
+        stats->count_write();
+        stats->cover_write(val, ~val);
+        if (desc->write_masked()) {
+            masked_update([val](uint32_t) { return val; });
+        } else if (desc->cb_wr == nullptr && !observed()) {
+            data->store(val, std::memory_order_release);
+        } else {
+            bus_wr(seq_write([this, val] { return data->exchange(val, std::memory_order_acq_rel); }), val);
         }
 
         return *this;
     }
 
     operator uint32_t() const {
-        uint32_t ret_val;
+        uint32_t ret_val = data->load(std::memory_order_acquire) & ~desc->wo;
 
-        if (cb_rd) {
-            ret_val =  cb_rd(data, param_rd);
-        } else {
-            ret_val = data;
+        stats->count_read();
+        stats->cover_read(~desc->wo);
+        if (desc->cb_rd) {
+            mem_stats.rd_cb_calls.fetch_add(1, std::memory_order_relaxed);
+            ret_val = stats->time_hook([this, ret_val] { return desc->cb_rd(ret_val, desc->param); });
+        }
+        if (observed()) {
+            mem_page_hit(desc, ret_val, ret_val, false, true);
         }
 
         return ret_val;
     }
 
-    uint32_t operator &=(int p_data) {
-        if (cb_rd) {
-            cb_rd(data, param_wr);
+    /**
+     * @brief Atomic AND as a single bus transaction, calls write callback once
+     * @param mask value to AND with the register
+     * @return register value before the operation
+     */
+    uint32_t fetch_and(uint32_t mask) {
+        stats->count_write();
+        stats->cover_write(0, ~mask);
+        if (desc->write_masked()) {
+            return masked_update([mask](uint32_t old_val) { return old_val & mask; });
+        }
+        if (desc->cb_wr == nullptr && !observed()) {
+            return data->fetch_and(mask, std::memory_order_acq_rel);
         }
+        uint32_t old_val = seq_write([this, mask] { return data->fetch_and(mask, std::memory_order_acq_rel); });
+        bus_wr(old_val, old_val & mask);
+        return old_val;
+    }
 
-        data = data & p_data;
+    /**
+     * @brief Atomic OR as a single bus transaction, calls write callback once
+     * @param mask value to OR with the register
+     * @return register value before the operation
+     */
+    uint32_t fetch_or(uint32_t mask) {
+        stats->count_write();
+        stats->cover_write(mask, 0);
+        if (desc->write_masked()) {
+            return masked_update([mask](uint32_t old_val) { return old_val | mask; });
+        }
+        if (desc->cb_wr == nullptr && !observed()) {
+            return data->fetch_or(mask, std::memory_order_acq_rel);
+        }
+        uint32_t old_val = seq_write([this, mask] { return data->fetch_or(mask, std::memory_order_acq_rel); });
+        bus_wr(old_val, old_val | mask);
+        return old_val;
+    }
+
+    /**
+     * @brief Atomic XOR as a single bus transaction, calls write callback once
+     * @param mask value to XOR with the register
+     * @return register value before the operation
+     */
+    uint32_t fetch_xor(uint32_t mask) {
+        uint32_t old_val;
 
-        if (cb_wr) {
-            cb_wr(data, param_wr);
+        stats->count_write();
+        if (desc->write_masked()) {
+            old_val = masked_update([mask](uint32_t val) { return val ^ mask; });
+        } else if (desc->cb_wr == nullptr && !observed()) {
+            old_val = data->fetch_xor(mask, std::memory_order_acq_rel);
+        } else {
+            old_val = seq_write([this, mask] { return data->fetch_xor(mask, std::memory_order_acq_rel); });
+            bus_wr(old_val, old_val ^ mask);
         }
+        /* Toggled bits are written with the opposite of their old value */
+        stats->cover_write(mask & ~old_val, mask & old_val);
+        return old_val;
+    }
 
-        return data;
+    uint32_t operator &=(int p_data) {
+        return fetch_and(p_data) & p_data;
     }
 
     uint32_t operator |=(int p_data) {
-        if (cb_rd) {
-            cb_rd(data, param_wr);
+        return fetch_or(p_data) | p_data;
+    }
+
+    uint32_t operator ^=(int p_data) {
+        return fetch_xor(p_data) ^ p_data;
+    }
+
+    /**
+     * @brief Peripheral side write, ignores access masks
+     * @param val value to write
+     */
+    void hw_write(uint32_t val) {
+        if (desc->cb_wr == nullptr && !observed()) {
+            data->store(val, std::memory_order_release);
+        } else {
+            hw_wr(seq_write([this, val] { return data->exchange(val, std::memory_order_acq_rel); }), val);
+        }
+    }
+
+    /**
+     * @brief Peripheral side atomic OR, ignores access masks
+     * @param mask bits to set
+     * @return register value before the operation
+     */
+    uint32_t hw_fetch_or(uint32_t mask) {
+        uint32_t old_val = seq_write([this, mask] { return data->fetch_or(mask, std::memory_order_acq_rel); });
+        hw_wr(old_val, old_val | mask);
+        return old_val;
+    }
+
+    /**
+     * @brief Peripheral side atomic AND, ignores access masks
+     * @param mask bits to keep
+     * @return register value before the operation
+     */
+    uint32_t hw_fetch_and(uint32_t mask) {
+        uint32_t old_val = seq_write([this, mask] { return data->fetch_and(mask, std::memory_order_acq_rel); });
+        hw_wr(old_val, old_val & mask);
+        return old_val;
+    }
+
+private:
+    /**
+     * @brief Firmware write on a register with access masks
+     * @param op computes the value written by the firmware from the old value
+     * @return register value before the operation
+     */
+    template<typename F>
+    uint32_t masked_update(F op) {
+        uint32_t new_val;
+        uint32_t old_val = seq_write([this, op, &new_val] {
+            uint32_t val = data->load(std::memory_order_relaxed);
+            do {
+                new_val = desc->bus_write(val, op(val));
+            } while (!data->compare_exchange_weak(val, new_val, std::memory_order_acq_rel,
+                                                  std::memory_order_relaxed));
+            return val;
+        });
+        bus_wr(old_val, new_val);
+        return old_val;
+    }
+
+    /**
+     * @brief Updates the register inside its sequence lock if the register file is exported
+     * @param op atomic update, returns the value before the update
+     * @return value returned by op
+     */
+    template<typename F>
+    uint32_t seq_write(F op) {
+        if (page_hooks[desc->addr >> MEM_PAGE_SHIFT].load(std::memory_order_relaxed) & PAGE_SHARED) {
+            mem_seq_lock(desc->addr);
+            uint32_t old_val = op();
+            mem_seq_unlock(desc->addr);
+            return old_val;
         }
+        return op();
+    }
 
-        data = data | p_data;
+    /**
+     * @brief Checks if the register is on a page with watchpoints or subscriptions
+     */
+    bool observed() const {
+        return page_hooks[desc->addr >> MEM_PAGE_SHIFT].load(std::memory_order_relaxed) != 0;
+    }
 
-        if (cb_wr) {
-            cb_wr(data, param_wr);
+    /**
+     * @brief Completes a firmware write: write callback, watchpoints and subscriptions
+     * @param old_val value before the write
+     * @param new_val value after the write
+     */
+    void bus_wr(uint32_t old_val, uint32_t new_val) const {
+        notify_wr(old_val, new_val);
+        if (observed()) {
+            mem_page_hit(desc, old_val, new_val, true, true);
         }
+    }
 
-        return data;
+    /**
+     * @brief Completes a peripheral write: write callback and subscriptions
+     * @param old_val value before the write
+     * @param new_val value after the write
+     */
+    void hw_wr(uint32_t old_val, uint32_t new_val) const {
+        notify_wr(old_val, new_val);
+        if (observed()) {
+            mem_page_hit(desc, old_val, new_val, true, false);
+        }
     }
 
-    uint32_t operator ^=(int p_data) {
+    /**
+     * @brief Calls write callback, if any
+     * @param old_val value before the write
+     * @param new_val value after the write
+     */
+    void notify_wr(uint32_t old_val, uint32_t new_val) const {
+        if (desc->cb_wr) {
+            mem_stats.wr_cb_calls.fetch_add(1, std::memory_order_relaxed);
+            stats->time_hook([this, old_val, new_val] { return desc->cb_wr(old_val, new_val, desc->param); });
+        }
+    }
+
+    std::atomic<uint32_t> *data;
+    const RegDesc *desc;
+    RegStats *stats;
+};
 
-        if (cb_rd) {
-            cb_rd(data, param_wr);
+/**
+ * @brief Page table entry: registers of the peripheral mapped on a page
+ */
+struct RegPage {
+    uint16_t first;     /**< Index in #reg_table of the first register */
+    uint16_t n_words;   /**< Number of registers, 0 if page is unmapped */
+};
+
+/**
+ * @brief Builds the page table from #reg_table
+ */
+constexpr std::array<RegPage, MEM_PAGES> build_reg_pages() {
+    std::array<RegPage, MEM_PAGES> pages{};
+
+    for (uint16_t i = 0; i < MEM_N_REGS; i++) {
+        RegPage &page = pages[reg_table[i].addr >> MEM_PAGE_SHIFT];
+        if (page.n_words == 0) {
+            page.first = i;
         }
+        page.n_words++;
+    }
+    return pages;
+}
 
-        data = data ^ p_data;
+/**
+ * @brief Checks that #reg_table can be decoded with a page table
+ */
+constexpr bool reg_table_valid() {
+    for (uint32_t i = 0; i < MEM_N_REGS; i++) {
+        uint32_t addr = reg_table[i].addr;
+        uint32_t offset = addr & ((1 << MEM_PAGE_SHIFT) - 1);
 
-        if (cb_wr) {
-            cb_wr(data, param_wr);
+        if ((addr >> MEM_PAGE_SHIFT) >= MEM_PAGES) {
+            return false;
+        }
+        /* First register of a page is at its base, the rest are consecutive */
+        if ((offset != 0) && (i == 0 || reg_table[i - 1].addr != addr - 4)) {
+            return false;
         }
-        return data;
     }
+    return true;
+}
+
+static_assert(reg_table_valid(), "reg_table registers must be consecutive words from the page base");
+
+/**
+ * @brief Page table, addr >> MEM_PAGE_SHIFT gives the registers of the page
+ */
+inline constexpr std::array<RegPage, MEM_PAGES> reg_pages = build_reg_pages();
+
+/**
+ * @brief Peripherals firmware can access directly through the Registers.h structs
+ *
+ * Direct accesses are plain loads and stores, so these peripherals cannot
+ * have read callbacks, write-1-to-clear bits or write callbacks on registers
+ * firmware can write.
+ */
+inline constexpr uint32_t direct_bases[] = {
+    ADDR_PORTA_CTRL, ADDR_PORTB_CTRL, ADDR_PORTC_CTRL, ADDR_PORTD_CTRL,
+    ADDR_DAC_CTRL,
+};
+
+/**
+ * @brief Checks if a register belongs to a peripheral in #direct_bases
+ * @param idx index in #reg_table
+ */
+constexpr bool reg_direct(uint32_t idx) {
+    for (uint32_t base : direct_bases) {
+        if ((reg_table[idx].addr >> MEM_PAGE_SHIFT) == (base >> MEM_PAGE_SHIFT)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Checks that direct access to the peripherals in #direct_bases has no side effects to miss
+ */
+constexpr bool direct_regs_valid() {
+    for (uint32_t i = 0; i < MEM_N_REGS; i++) {
+        const RegDesc &desc = reg_table[i];
+
+        if (reg_direct(i) && ((desc.cb_rd != nullptr) || (desc.w1c != 0) ||
+                              ((desc.cb_wr != nullptr) && (desc.ro != 0xFFFFFFFF)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(direct_regs_valid(), "registers of direct_bases peripherals must not have side effects");
+
+/** Maximum number of RAM and Flash regions */
+#define MEM_MAX_REGIONS (4)
+
+/**
+ * @brief Contiguous RAM or Flash region
+ *
+ * Regions are plain memory without callbacks, so block transfers are a
+ * memcpy.
+ */
+struct MemRegion {
+    uint32_t base;  /**< Address of the first byte */
+    uint32_t size;  /**< Size in bytes */
+    uint8_t *data;  /**< Region storage */
+};
+
+/**
+ * @brief Action taken on an access to an unmapped address
+ */
+enum class BusFault {
+    Log,    /**< print the faulting access and continue */
+    Irq,    /**< call the bus fault IRQ callback */
+    Abort,  /**< print the faulting access and abort the simulation */
+};
+
+/**
+ * @brief definition of bus fault IRQ callback type
+ *
+ * Receives the faulting address and true if the access was a write.
+ */
+using bus_fault_func = void (*)(uint32_t, bool);
+
+/** Maximum number of watchpoints */
+#define MEM_MAX_WATCHES (8)
+
+/**
+ * @brief Action taken when a watchpoint triggers
+ */
+enum class WatchAction {
+    Log,        /**< print the access */
+    Count,      /**< only count the hit */
+    Callback,   /**< call the watchpoint callback */
+    Pause,      /**< print the access and stop the accessing task until resume() */
+};
+
+/**
+ * @brief definition of watchpoint callback type
+ *
+ * Receives the register address, the value before and after the access and
+ * true if the access was a write.
+ */
+using watch_func = void (*)(uint32_t, uint32_t, uint32_t, bool);
+
+/**
+ * @brief Watchpoint on a range of registers
+ *
+ * Reads trigger on every access, writes only when they change a bit of the
+ * mask.
+ */
+struct Watchpoint {
+    bool used;              /**< slot in use */
+    uint32_t first;         /**< first address watched */
+    uint32_t last;          /**< last address watched */
+    uint32_t mask;          /**< bits watched on writes */
+    bool on_read;           /**< trigger on firmware reads */
+    bool on_write;          /**< trigger on firmware writes */
+    WatchAction action;     /**< action on trigger */
+    watch_func cb;          /**< callback for WatchAction::Callback */
+    uint64_t hits;          /**< times triggered */
+};
+
+/**
+ * @brief Watchpoint slot, read without locks by the accesses
+ *
+ * add_watch() and remove_watch() make seq odd while they change the slot, an
+ * access that sees it odd or changed skips the slot, like a watchpoint added
+ * or removed just after it.
+ */
+struct WatchSlot {
+    std::atomic<uint32_t> seq;          /**< odd while the slot changes */
+    std::atomic<bool> used;             /**< slot in use */
+    std::atomic<uint32_t> first;        /**< first address watched */
+    std::atomic<uint32_t> last;         /**< last address watched */
+    std::atomic<uint32_t> mask;         /**< bits watched on writes */
+    std::atomic<bool> on_read;          /**< trigger on firmware reads */
+    std::atomic<bool> on_write;         /**< trigger on firmware writes */
+    std::atomic<WatchAction> action;    /**< action on trigger */
+    std::atomic<watch_func> cb;         /**< callback for WatchAction::Callback */
+    std::atomic<uint64_t> hits;         /**< times triggered */
+};
+
+/**
+ * @brief definition of the WatchAction::Pause handler type
+ *
+ * Stops the calling task until the resume handler runs. Returns false if the
+ * calling thread cannot be stopped, it then carries on.
+ */
+using pause_func = bool (*)();
+
+/**
+ * @brief definition of the resume handler type, restarts the stopped tasks
+ */
+using resume_func = void (*)();
+
+/** Maximum number of change subscriptions */
+#define MEM_MAX_SUBSCRIPTIONS (8)
+
+/**
+ * @brief Register change notification
+ */
+struct RegChange {
+    uint32_t addr;      /**< Register address */
+    uint32_t value;     /**< Register value when the notification was popped */
+};
+
+/**
+ * @brief Lock-free queue of register change notifications
+ *
+ * Notifications are coalesced: a register changed several times before the
+ * observer pops it is queued once, so the queue never holds more than one
+ * entry per register and never overflows. Any thread can push, a single
+ * observer thread pops.
+ */
+class RegQueue {
+public:
+    RegQueue();
+
+    /**
+     * @brief Queues a change of a register, unless it is already queued
+     * @param idx index in #reg_table of the register
+     */
+    void push(uint32_t idx);
 
     /**
-     * @brief Registers callback function for a memory address
-     * @param cb function to call when memory read
-     * @param param parameter to send to the callback function
-     * @return true
+     * @brief Takes the oldest notification
+     * @param change register address and its current value
+     * @return false if the queue is empty
      */
-    bool register_rd_cb(cb_func cb, uint32_t param) {
-        cb_rd = std::move(cb);
-        param_rd = param;
-        return true;
+    bool pop(RegChange &change);
+
+private:
+    static constexpr uint32_t RING_SIZE = 64;
+    static_assert(RING_SIZE >= MEM_N_REGS, "RegQueue ring must hold one entry per register");
+
+    std::atomic<uint64_t> pending[(MEM_N_REGS + 63) / 64];
+    std::atomic<int16_t> ring[RING_SIZE];
+    std::atomic<uint32_t> tail;
+    uint32_t head;
+};
+
+/**
+ * @brief Subscription of a queue to changes on a range of registers
+ */
+struct Subscription {
+    std::atomic<RegQueue *> queue;  /**< observer queue, nullptr if slot is free */
+    std::atomic<uint32_t> first;    /**< first address */
+    std::atomic<uint32_t> last;     /**< last address */
+    std::atomic<uint32_t> mask;     /**< bits that trigger a notification */
+};
+
+/**
+ * @brief Decoded MCU address space
+ *
+ * Each 4 KB page points to the registers of the peripheral mapped there, so
+ * an access is resolved with a page table load and an array index. The page
+ * table is generated at compile time from #reg_table, so accesses to constant
+ * addresses are resolved by the compiler.
+ * Addresses not covered by any register resolve to a single register that
+ * reads as zero and raises a bus fault on every access, so the memory
+ * footprint does not depend on what the firmware accesses.
+ *
+ * RAM and Flash regions live outside the page table, above the peripheral
+ * space. operator[] only decodes registers, read() and write() decode any
+ * address.
+ */
+class MemoryMap {
+public:
+    MemoryMap();
+
+    WordMem operator[](uint32_t addr) {
+        int idx = reg_index(addr);
+
+        if (idx >= 0) {
+            return mapped_reg(idx);
+        }
+
+        return unmapped_reg(addr);
     }
 
     /**
-     * @brief Registers callback function for a memory address
-     * @param cb function to call when memory written
-     * @param param parameter to send to the callback function
-     * @return true
+     * @brief Backdoor read, returns the stored value without side effects
+     *
+     * For peripheral models, the GUI and tools: no callbacks, access masks,
+     * counters, watchpoints or bus faults. Unmapped addresses read as 0.
+     * @param addr address to access
+     * @return stored value
      */
-    bool register_wr_cb(cb_func cb, uint32_t param) {
-        cb_wr = std::move(cb);
-        param_wr = param;
-        return true;
+    uint32_t peek(uint32_t addr) const {
+        int idx = reg_index(addr);
+
+        if (idx >= 0) {
+            return reg_data[idx].load(std::memory_order_acquire);
+        }
+        return peek_region(addr);
     }
 
+    /**
+     * @brief Backdoor write, changes the stored value without side effects
+     *
+     * Writes to unmapped addresses are ignored.
+     * @param addr address to access
+     * @param val value to store
+     */
+    void poke(uint32_t addr, uint32_t val) {
+        int idx = reg_index(addr);
+
+        if (idx < 0) {
+            poke_region(addr, val);
+        } else if (page_hooks[addr >> MEM_PAGE_SHIFT].load(std::memory_order_relaxed) & PAGE_SHARED) {
+            mem_seq_lock(addr);
+            reg_data[idx].store(val, std::memory_order_relaxed);
+            mem_seq_unlock(addr);
+        } else {
+            reg_data[idx].store(val, std::memory_order_release);
+        }
+    }
+
+    /**
+     * @brief Decodes a register address
+     * @param addr address to decode
+     * @return index in #reg_table, -1 if no register is mapped at addr
+     */
+    static constexpr int reg_index(uint32_t addr) {
+        uint32_t page = addr >> MEM_PAGE_SHIFT;
+
+        if (page < MEM_PAGES) {
+            RegPage regs = reg_pages[page];
+            uint32_t idx = (addr & ((1 << MEM_PAGE_SHIFT) - 1)) >> 2;
+
+            if (((addr & 0x03) == 0) && (idx < regs.n_words)) {
+                return regs.first + idx;
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * @brief Sets all registers to their reset value
+     */
+    void reset();
+
+    /**
+     * @brief Reads a word from a register, RAM or Flash
+     * @param addr address to access
+     * @return data read
+     */
+    uint32_t read(uint32_t addr) {
+        if ((addr >> MEM_PAGE_SHIFT) < MEM_PAGES) {
+            return (*this)[addr];
+        }
+        return read_region(addr);
+    }
+
+    /**
+     * @brief Writes a word to a register, RAM or Flash
+     * @param addr address to access
+     * @param val data to write
+     */
+    void write(uint32_t addr, uint32_t val) {
+        if ((addr >> MEM_PAGE_SHIFT) < MEM_PAGES) {
+            (*this)[addr] = val;
+        } else {
+            write_region(addr, val);
+        }
+    }
+
+    /**
+     * @brief Maps a zero initialized RAM region
+     * @param base address of the region, outside the peripheral space
+     * @param size size in bytes
+     * @return true on success
+     */
+    bool add_ram(uint32_t base, uint32_t size);
+
+    /**
+     * @brief Maps a Flash region backed by a file
+     *
+     * The file is mapped copy-on-write, so firmware writes are private to
+     * the simulation unless persistent is set. Bytes beyond the end of the
+     * file read as erased Flash (0xFF).
+     * @param base address of the region, outside the peripheral space
+     * @param size size in bytes
+     * @param path file with the Flash contents
+     * @param persistent true to write changes back to the file
+     * @return true on success
+     */
+    bool add_flash(uint32_t base, uint32_t size, const char *path, bool persistent);
+
+    /**
+     * @brief Reads consecutive words
+     * @param addr address of the first word
+     * @param dst buffer for the data read
+     * @param n_words number of words to read
+     */
+    void read_block(uint32_t addr, uint32_t *dst, uint32_t n_words);
+
+    /**
+     * @brief Writes consecutive words
+     * @param addr address of the first word
+     * @param src data to write
+     * @param n_words number of words to write
+     */
+    void write_block(uint32_t addr, const uint32_t *src, uint32_t n_words);
+
+    /**
+     * @brief Writes the same value to consecutive words
+     * @param addr address of the first word
+     * @param val value to write
+     * @param n_words number of words to write
+     */
+    void fill(uint32_t addr, uint32_t val, uint32_t n_words);
+
+    /**
+     * @brief Prints the access counters of the registers that were accessed
+     *
+     * Registers are sorted by number of accesses, so the registers the
+     * firmware polls come first.
+     * @param out stream to print to
+     */
+    void report(FILE *out) const;
+
+    /**
+     * @brief Clears the access counters of all registers
+     *
+     * Bit coverage is kept, it covers the whole simulation.
+     */
+    void reset_stats();
+
+    /**
+     * @brief Prints the bits of every register the firmware has read, written as 0 and written as 1
+     *
+     * Percentages are over the bits that can be read (not write-only) and
+     * written (not read-only).
+     * @param out stream to print to
+     */
+    void coverage_report(FILE *out) const;
+
+    /**
+     * @brief Access counters of unmapped addresses
+     */
+    const RegStats &unmapped_stats() const;
+
+    /**
+     * @brief Adds a watchpoint on firmware accesses to a range of registers
+     *
+     * Pages without watchpoints keep the fast path, watching a register only
+     * slows down the accesses to its peripheral.
+     * @param first first address watched
+     * @param last last address watched
+     * @param mask bits watched on writes
+     * @param on_read trigger on reads
+     * @param on_write trigger on writes that change a bit of mask
+     * @param action action on trigger
+     * @param cb callback for WatchAction::Callback
+     * @return watchpoint id, -1 if there are no free slots
+     */
+    int add_watch(uint32_t first, uint32_t last, uint32_t mask, bool on_read, bool on_write,
+                  WatchAction action, watch_func cb = nullptr);
+
+    /**
+     * @brief Removes a watchpoint
+     * @param id watchpoint id returned by add_watch()
+     * @return true on success
+     */
+    bool remove_watch(int id);
+
+    /**
+     * @brief Gets a copy of a watchpoint
+     * @param id watchpoint id
+     * @param watch copy of the watchpoint
+     * @return true if the watchpoint exists
+     */
+    bool get_watch(int id, Watchpoint &watch) const;
+
+    /**
+     * @brief Subscribes a queue to changes on a range of registers
+     *
+     * Firmware writes, hw_* operations and changes found by sync_direct()
+     * that change a bit of mask push a notification to the queue. The queue
+     * must not be destroyed while subscribed.
+     * @param first first address
+     * @param last last address
+     * @param mask bits that trigger a notification
+     * @param queue observer queue
+     * @return subscription id, -1 if there are no free slots
+     */
+    int subscribe(uint32_t first, uint32_t last, uint32_t mask, RegQueue *queue);
+
+    /**
+     * @brief Removes a subscription
+     * @param id subscription id returned by subscribe()
+     * @return true on success
+     */
+    bool unsubscribe(int id);
+
+    /**
+     * @brief Moves the register file to a POSIX shared memory segment
+     *
+     * External processes can then map the segment read-only, see RegShm.h
+     * for its layout. Register writes take the sequence lock of their block,
+     * so every page leaves the fast path. Must be called before the
+     * simulation starts, writes done while the registers are copied are lost.
+     * @param name segment name for shm_open(), e.g. "/socsim"
+     * @return true on success
+     */
+    bool export_shm(const char *name);
+
+    /**
+     * @brief Removes the shared memory segment name, mappings stay valid
+     */
+    void unlink_shm();
+
+    /**
+     * @brief Sets the critical section the writers of the shared memory take around its sequence lock
+     *
+     * The memory map knows nothing about the kernel, the SoC keeps the other
+     * tasks out while a task holds a sequence lock. Host threads are never
+     * switched out by the kernel, the guard lets them through. Must be
+     * called before the simulation starts.
+     * @param enter enters the critical section
+     * @param exit leaves it
+     */
+    void set_shm_guard(shm_guard_func enter, shm_guard_func exit);
+
+    /**
+     * @brief Detects changes made through the Registers.h structs
+     *
+     * Direct accesses and poke() bypass the callbacks, so each register of the
+     * #direct_bases peripherals is compared with the value seen by the
+     * previous call. Changes trigger watchpoints and subscriptions.
+     * Several writes between two calls are seen as a single change.
+     * @return number of registers changed since the previous call
+     */
+    uint32_t sync_direct();
+
+    /**
+     * @brief Checks if a task is stopped by a WatchAction::Pause watchpoint
+     */
+    bool paused() const;
+
+    /**
+     * @brief Resumes the tasks stopped by WatchAction::Pause watchpoints
+     */
+    void resume();
+
+    /**
+     * @brief Sets how WatchAction::Pause watchpoints stop and resume the tasks
+     *
+     * The memory map knows nothing about the kernel, the SoC suspends the
+     * accessing task. Without handlers the watchpoints cannot pause.
+     * @param pause_cb stops the calling task
+     * @param resume_cb restarts the stopped tasks, from any thread
+     */
+    void set_pause(pause_func pause_cb, resume_func resume_cb);
+
+    /**
+     * @brief Handles an access to a register on a page with watchpoints or subscriptions
+     */
+    void page_hit(const RegDesc *desc, uint32_t old_val, uint32_t new_val, bool write, bool firmware);
+
+    /**
+     * @brief Handles a firmware access to a register on a watched page
+     * @param desc register accessed
+     * @param old_val value before the access
+     * @param new_val value after the access
+     * @param write true on write accesses
+     * @param deferred true for changes found by sync_direct(), they do not pause
+     */
+    void watch_hit(const RegDesc *desc, uint32_t old_val, uint32_t new_val, bool write, bool deferred = false);
+
+    /**
+     * @brief Selects what happens on accesses to unmapped addresses
+     * @param action action to take, BusFault::Log by default
+     * @param irq_cb callback called with BusFault::Irq
+     */
+    void set_bus_fault(BusFault action, bus_fault_func irq_cb = nullptr);
+
+    /**
+     * @brief Handles an access to an unmapped address
+     * @param addr faulting address
+     * @param write true on write accesses
+     */
+    void bus_fault(uint32_t addr, bool write);
+
 private:
-    uint32_t data;
-    uint32_t param_rd;
-    uint32_t param_wr;
-    cb_func cb_rd;
-    cb_func cb_wr;
+    /**
+     * @brief Finds the RAM or Flash region of an address
+     * @param addr address to look for
+     * @return region, nullptr if addr is not in any region
+     */
+    const MemRegion *find_region(uint32_t addr) const;
+
+    /**
+     * @brief Adds a region to the region table
+     * @return true on success
+     */
+    bool add_region(uint32_t base, uint32_t size, uint8_t *data);
+
+    /**
+     * @brief Reads a word outside the peripheral space
+     */
+    uint32_t read_region(uint32_t addr);
+
+    /**
+     * @brief Writes a word outside the peripheral space
+     */
+    void write_region(uint32_t addr, uint32_t val);
+
+    /**
+     * @brief Decodes a range of consecutive words inside a RAM or Flash region
+     * @param addr address of the first word
+     * @param n_words number of words wanted
+     * @param n returns how many of them are in the same region
+     * @return storage of the first word, nullptr if addr is not in a region
+     */
+    uint8_t *region_range(uint32_t addr, uint32_t n_words, uint32_t &n) const;
+
+    /**
+     * @brief Decodes a range of consecutive words inside a single peripheral
+     * @param addr address of the first word
+     * @param n_words number of words wanted
+     * @param n returns how many of them are in the same peripheral
+     * @return index in #reg_table of the first register, -1 if addr is unmapped
+     */
+    int decode_range(uint32_t addr, uint32_t n_words, uint32_t &n) const;
+
+    /**
+     * @brief Backdoor read outside the peripheral space
+     */
+    uint32_t peek_region(uint32_t addr) const;
+
+    /**
+     * @brief Backdoor write outside the peripheral space
+     */
+    void poke_region(uint32_t addr, uint32_t val);
+
+    /**
+     * @brief Returns the register at an index of #reg_table
+     */
+    static WordMem mapped_reg(uint32_t idx) {
+        return WordMem(&reg_data[idx], &reg_table[idx], &reg_stats[idx]);
+    }
+
+    /**
+     * @brief Returns the register used for unmapped accesses
+     * @param addr unmapped address, kept for the bus fault callbacks
+     */
+    WordMem unmapped_reg(uint32_t addr);
+
+    /**
+     * @brief Rebuilds #page_hooks from the watchpoint and subscription tables, hook_mutex held
+     */
+    void update_page_hooks();
+
+    /**
+     * @brief Pushes a change to the queues subscribed to it
+     * @param idx index in #reg_table of the register
+     * @param old_val value before the change
+     * @param new_val value after the change
+     */
+    void notify_subscribers(uint32_t idx, uint32_t old_val, uint32_t new_val);
+
+    std::atomic<BusFault> fault_action;
+    std::atomic<bus_fault_func> fault_irq_cb;
+    MemRegion regions[MEM_MAX_REGIONS];
+    std::atomic<uint32_t> n_regions;
+    WatchSlot watches[MEM_MAX_WATCHES];
+    Subscription subscriptions[MEM_MAX_SUBSCRIPTIONS];
+    std::mutex hook_mutex;      /**< serializes the watchpoint and subscription changes, never taken by an access */
+    std::atomic<pause_func> watch_pause_cb;
+    std::atomic<resume_func> watch_resume_cb;
+    std::atomic<uint32_t> watch_paused;     /**< tasks stopped by WatchAction::Pause watchpoints */
+    std::atomic<uint32_t> direct_shadow[MEM_N_REGS];
+    char shm_name[64];
+    bool shm_exported;
 };
 
-extern std::unordered_map<uint32_t, WordMem> memory;
+extern MemoryMap memory;
 
 #endif //PRAC1_MEMORY_H
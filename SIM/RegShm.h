@@ -0,0 +1,112 @@
+/*!
+ \file RegShm.h
+ \brief Layout of the register file exported in POSIX shared memory
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _REGSHM_H_
+#define _REGSHM_H_
+
+/*
+ * The segment is opened with shm_open() using the name given to
+ * SoC_ShmConfig() and mapped read-only by external processes:
+ *
+ *   offset 0x0000  register values, one uint32_t per register, in the order
+ *                  of the descriptor table (a full page, unused words are 0)
+ *   offset 0x1000  reg_shm_header_t
+ *   seq_offset     one uint32_t sequence counter per 4 KB block of the
+ *                  peripheral space (n_blocks entries)
+ *   desc_offset    n_regs reg_shm_desc_t
+ *
+ * A block is the 4 KB page of a peripheral: the sequence counter of a
+ * register is seq[addr >> 12]. The simulator makes the counter odd while it
+ * updates a register of the block and even again afterwards, so a reader gets
+ * a consistent copy of a peripheral with reg_shm_read_block().
+ * Firmware writes through the Registers.h structs do not take the sequence
+ * lock, they only bump the counter when the simulator notices them.
+ */
+
+#ifdef __cplusplus
+#include <cstdint>
+extern "C" {
+#else
+#include <stdint.h>
+#include <stdbool.h>
+#endif
+
+/** "SCSM" */
+#define REG_SHM_MAGIC       (0x4D534353)
+
+/** Layout version */
+#define REG_SHM_VERSION     (1)
+
+/** Offset of the register values */
+#define REG_SHM_REGS_OFFSET (0x0000)
+
+/** Offset of the header */
+#define REG_SHM_HDR_OFFSET  (0x1000)
+
+/** Size of the segment */
+#define REG_SHM_SIZE        (0x2000)
+
+/** Maximum length of a register name, including the terminating 0 */
+#define REG_SHM_NAME_LEN    (20)
+
+/**
+ * @brief Segment header
+ */
+typedef struct {
+    uint32_t magic;         /**< REG_SHM_MAGIC */
+    uint32_t version;       /**< REG_SHM_VERSION */
+    uint32_t n_regs;        /**< number of registers */
+    uint32_t n_blocks;      /**< number of sequence counters */
+    uint32_t block_shift;   /**< addr >> block_shift gives the block of a register */
+    uint32_t seq_offset;    /**< offset of the sequence counters */
+    uint32_t desc_offset;   /**< offset of the register descriptors */
+    uint32_t reserved;
+} reg_shm_header_t;
+
+/**
+ * @brief Register descriptor
+ */
+typedef struct {
+    uint32_t addr;                  /**< register address */
+    char name[REG_SHM_NAME_LEN];    /**< register name */
+} reg_shm_desc_t;
+
+/**
+ * @brief Reads consecutive registers of a block with the sequence lock
+ * @param base start of the mapped segment
+ * @param first index of the first register in the descriptor table
+ * @param n number of registers, all in the same block
+ * @param dst buffer for the values
+ * @return sequence counter of the copy
+ */
+static inline uint32_t reg_shm_read_block(const void *base, uint32_t first, uint32_t n, uint32_t *dst) {
+    const reg_shm_header_t *hdr = (const reg_shm_header_t *) ((const char *) base + REG_SHM_HDR_OFFSET);
+    const reg_shm_desc_t *desc = (const reg_shm_desc_t *) ((const char *) base + hdr->desc_offset);
+    const uint32_t *seq = (const uint32_t *) ((const char *) base + hdr->seq_offset) +
+                          (desc[first].addr >> hdr->block_shift);
+    const uint32_t *regs = (const uint32_t *) ((const char *) base + REG_SHM_REGS_OFFSET) + first;
+    uint32_t s1;
+    uint32_t s2;
+
+    do {
+        s1 = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; i < n; i++) {
+            dst[i] = __atomic_load_n(&regs[i], __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(seq, __ATOMIC_RELAXED);
+    } while ((s1 & 1) || (s1 != s2));
+
+    return s1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
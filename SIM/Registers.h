@@ -0,0 +1,100 @@
+/*!
+ \file Registers.h
+ \brief CMSIS-like peripheral structs for direct register access
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * Accesses through these structs are plain loads and stores on the register
+ * file: no callbacks, no access counters. Writes are only noticed when the
+ * GUI thread calls memory.sync_direct(), once per GUI frame: watchpoints and
+ * subscriptions on these registers trigger then, and several writes within
+ * a frame are seen as one change.
+ *
+ * Only peripherals whose registers need no callback have a struct. The
+ * timer and the RTC compute TIMER_CNT and RTC_CNT in read callbacks from the
+ * virtual time, a plain load would read a stale value, so they have none:
+ * use TIMER_CounterGet(), RTC_CounterGet() and the other HAL calls.
+ */
+
+#ifndef _REGISTERS_H_
+#define _REGISTERS_H_
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <cstddef>
+#include "Memory.h"
+#else
+#include <stdint.h>
+#endif
+
+/** Read-only register */
+#define __I     volatile const
+/** Write-only register */
+#define __O     volatile
+/** Read-write register */
+#define __IO    volatile
+
+/**
+ * @brief GPIO port registers
+ */
+typedef struct {
+    __IO uint32_t CTRL;     /**< 1 - out, 0 - in */
+    __IO uint32_t INT;      /**< 1 - Interrupt enabled */
+    __IO uint32_t OUT;      /**< Output pin values */
+    __I  uint32_t IN;       /**< Input pin values */
+} GPIO_TypeDef;
+
+/**
+ * @brief DAC registers
+ */
+typedef struct {
+    __IO uint32_t CTRL;     /**< Enable and IRQ enable */
+    __IO uint32_t DATA;     /**< Sample value */
+} DAC_TypeDef;
+
+/* Index of the first register of each peripheral in the register file */
+#define GPIOA_REG_INDEX (0)
+#define GPIOB_REG_INDEX (4)
+#define GPIOC_REG_INDEX (8)
+#define GPIOD_REG_INDEX (12)
+#define DAC_REG_INDEX   (32)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Register file as plain words, defined in Memory.cpp
+ *
+ * Points to reg_data, an array of std::atomic<uint32_t> that C cannot
+ * declare. Memory.h checks that it has the layout of a uint32_t array.
+ */
+extern volatile uint32_t *const reg_file;
+
+#ifdef __cplusplus
+}
+#endif
+
+/** Register file as seen by the peripheral structs */
+#define REG_FILE (reg_file)
+
+#define GPIOA   ((GPIO_TypeDef *) &REG_FILE[GPIOA_REG_INDEX])
+#define GPIOB   ((GPIO_TypeDef *) &REG_FILE[GPIOB_REG_INDEX])
+#define GPIOC   ((GPIO_TypeDef *) &REG_FILE[GPIOC_REG_INDEX])
+#define GPIOD   ((GPIO_TypeDef *) &REG_FILE[GPIOD_REG_INDEX])
+#define DAC     ((DAC_TypeDef *) &REG_FILE[DAC_REG_INDEX])
+
+#ifdef __cplusplus
+static_assert(MemoryMap::reg_index(ADDR_PORTA_CTRL) == GPIOA_REG_INDEX, "GPIOA does not match reg_table");
+static_assert(MemoryMap::reg_index(ADDR_PORTB_CTRL) == GPIOB_REG_INDEX, "GPIOB does not match reg_table");
+static_assert(MemoryMap::reg_index(ADDR_PORTC_CTRL) == GPIOC_REG_INDEX, "GPIOC does not match reg_table");
+static_assert(MemoryMap::reg_index(ADDR_PORTD_CTRL) == GPIOD_REG_INDEX, "GPIOD does not match reg_table");
+static_assert(MemoryMap::reg_index(ADDR_DAC_CTRL) == DAC_REG_INDEX, "DAC does not match reg_table");
+static_assert(offsetof(GPIO_TypeDef, IN) == ADDR_PORTA_IN - ADDR_PORTA_CTRL, "GPIO_TypeDef layout");
+static_assert(offsetof(DAC_TypeDef, DATA) == ADDR_DAC_DATA - ADDR_DAC_CTRL, "DAC_TypeDef layout");
+#endif
+
+#endif
@@ -6,10 +6,18 @@
  */
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <vector>
 #include <semaphore.h>
+#include <unistd.h>
 
 #include "SoC.h"
 #include "Memory.h"
+#include "EventQueue.h"
 #include "HAL.h"
 #include "GUI.h"
 #include "UART.h"
@@ -38,122 +46,69 @@
 #define NVIC_PORTD_IRQ_BIT (1 << NVIC_PORTD_IRQ_NUM)
 
 /**
- * @brief BIT for RTC IRQ in the NVIC register
- */
-#define NVIC_RTC_IRQ_BIT (1 << NVIC_RTC_IRQ_NUM)
-
-/**
- * @brief BIT for DAC IRQ in the NVIC register
- */
-#define NVIC_DAC_IRQ_BIT (1 << NVIC_DAC_IRQ_NUM)
-
-/**
- * @brief BIT for UART IRQ in the NVIC register
- */
-#define NVIC_UART_IRQ_BIT (1 << NVIC_UART_IRQ_NUM)
-
-/**
- * @brief Semaphore to indicate that a GPIO IRQ is triggered
+ * @brief BIT for TIMER overflow IRQ in the NVIC register
  */
-sem_t mutex_gpio;
+#define NVIC_TIMER_OVF_IRQ_BIT (1 << NVIC_TIMER_OVF_IRQ_NUM)
 
 /**
- * @brief Semaphore to indicate UART new data in RX
+ * @brief BIT for TIMER compare IRQ in the NVIC register
  */
-SemaphoreHandle_t UART_RX_IRQ;
+#define NVIC_TIMER_CMP_IRQ_BIT (1 << NVIC_TIMER_CMP_IRQ_NUM)
 
 /**
- * @brief Semaphore to indicate UART finished send TX data
- */
-SemaphoreHandle_t UART_TX_IRQ;
-
-/**
- * @brief Semaphore to indicat if Watchdog has been enabled
- */
-SemaphoreHandle_t WDT_Enable;
-
-/**
- * @brief Semaphore to indicat if Watchdog has been feed
- */
-SemaphoreHandle_t WDT_Feed;
-
-/**
- * @brief GPIO IRQ task handle, it depends on #mutex_gpio
- */
-TaskHandle_t GPIO_IRQ_handle;
-
-/**
- * @brief RTC IRQ task handle
+ * @brief BIT for RTC IRQ in the NVIC register
  */
-TaskHandle_t RTC_IRQ_handle;
+#define NVIC_RTC_IRQ_BIT (1 << NVIC_RTC_IRQ_NUM)
 
 /**
- * @brief DAC IRQ task handle
+ * @brief BIT for DAC IRQ in the NVIC register
  */
-TaskHandle_t DAC_IRQ_handle;
+#define NVIC_DAC_IRQ_BIT (1 << NVIC_DAC_IRQ_NUM)
 
 /**
- * @brief UART IRQ task handle
+ * @brief BIT for UART IRQ in the NVIC register
  */
-TaskHandle_t UART_IRQ_handle;
+#define NVIC_UART_IRQ_BIT (1 << NVIC_UART_IRQ_NUM)
 
 /**
- * @brief ADC IRQ task handle
+ * @brief BIT for bus fault IRQ in the NVIC register
  */
-TaskHandle_t ADC_IRQ_handle;
+#define NVIC_BUSFAULT_IRQ_BIT (1U << NVIC_BUSFAULT_IRQ_NUM)
 
 /**
- * @brief Watchdog task handle
+ * @brief Interrupt dispatcher task handle
  */
-TaskHandle_t WDT_handle;
+static TaskHandle_t nvic_task;
 
 /* Forward declarations */
 
 /**
- * @brief RTC thread
- */
-[[noreturn]] void RTC_IRQ_thread(void *);
-
-/**
- * @brief DAC thread
- */
-[[noreturn]] void DAC_IRQ_thread(void *);
-
-/**
- * @brief UART thread
+ * @brief DAC event
  */
-[[noreturn]] void UART_IRQ_thread(void *);
+static void DAC_event(uint32_t);
 
 /**
- * @brief ADC thread
+ * @brief Interrupt dispatcher task
  */
-[[noreturn]] void ADC_IRQ_thread(void *);
+[[noreturn]] static void NVIC_thread(void *);
+static void NVIC_input(uint32_t param);
 
 /**
- * @brief Watchdog thread
+ * @brief Virtual time spent in a power mode
  */
-[[noreturn]] void WDT_thread(void *);
+static uint64_t PWR_residency(int mode);
 
 /**
- * @brief  write callback function for WDT_CTRL register
- * @param val unused
- * @param param unused
- */
-uint32_t WDT_cb(int val, int param);
-
-/**
- * @brief write callback function for WDT_CMD register
- * @param val value to write
- * @param param unused
+ * @brief Shared memory writer guard
  */
-uint32_t WDT_feed_cb(int val, int param);
+static void SHM_enter();
+static void SHM_exit();
 
 /**
- * @brief read callback function for ADC data register
- * @param val unused
- * @param param unused
+ * @brief WatchAction::Pause handlers
  */
-uint32_t ADC_data_cb(int val, int param);
+static bool WATCH_pause();
+static void WATCH_resume();
 
 /**
  * @brief UART class
@@ -174,6 +129,16 @@ __attribute__((weak)) void PORT_A_ISR(void);
  */
 __attribute__((weak)) void PORT_B_ISR(void);
 
+/**
+ * @brief TIMER overflow ISR must be defined by the user
+ */
+__attribute__((weak)) void TIMER_OVF_ISR(void);
+
+/**
+ * @brief TIMER compare ISR must be defined by the user
+ */
+__attribute__((weak)) void TIMER_CMP_ISR(void);
+
 /**
  * @brief RTC ISR must be defined by the user
  */
@@ -194,41 +159,59 @@ __attribute__((weak)) void UART_RX_ISR(void);
  */
 __attribute__((weak)) void UART_TX_ISR(void);
 
+/**
+ * @brief Bus fault ISR may be defined by the user
+ * @param addr faulting address
+ * @param write true on write accesses
+ */
+__attribute__((weak)) void BUS_FAULT_ISR(uint32_t addr, bool write);
+
 #ifdef __cplusplus
 }
 #endif
 
+/** Distance between the registers of two GPIO ports */
+#define GPIO_PORT_STRIDE (ADDR_PORTB_IN - ADDR_PORTA_IN)
+
+static void ADC_input(uint32_t param);
+
 /**
- * @brief Thread to manage GPIO IRQs
- * @param parameters unused
+ * @brief Host input that sets a GPIO input pin
+ * @param param port (0 for PORTA) << 8 | pin << 1 | level
  */
-[[noreturn]] void GPIO_IRQ_thread(void *parameters) {
-    (void) parameters;
-    while (true) {
-        if (sem_wait(&mutex_gpio) == 0) {
-            uint32_t pending_irq = memory[ADDR_NVIC_IRQ];
+static void GPIO_input(uint32_t param) {
+    uint32_t addr = ADDR_PORTA_IN + (param >> 8) * GPIO_PORT_STRIDE;
+    uint32_t mask = 1U << ((param >> 1) & 0x1F);
 
-            if (pending_irq & NVIC_PORTA_IRQ_BIT) {
-                PORT_A_ISR();
-                sem_post(&mutex_gpio);
-                vTaskDelay(10);
-            }
+    if (param & 1) {
+        memory[addr].hw_fetch_or(mask);
+    } else {
+        memory[addr].hw_fetch_and(~mask);
+    }
+}
 
-            if (pending_irq & NVIC_PORTB_IRQ_BIT) {
-                PORT_B_ISR();
-                sem_post(&mutex_gpio);
-                vTaskDelay(10);
-            }
-        }
+/**
+ * @brief Sets a GPIO input pin from the GUI
+ * @param port port, 0 for PORTA
+ * @param pin pin number
+ * @param level new level
+ */
+static void GPIO_set_input(uint32_t port, uint32_t pin, bool level) {
+    bool cur = (memory.peek(ADDR_PORTA_IN + port * GPIO_PORT_STRIDE) >> pin) & 1;
+
+    /* The GUI sets the buttons on every frame, only changes are inputs */
+    if (cur != level) {
+        events.input(GPIO_input, (port << 8) | (pin << 1) | (level ? 1 : 0));
     }
 }
 
 /**
  * @brief CB function to trigger (if necessary) corresponding GPIO IRQ
- * @param val PIN that has a change
+ * @param old_val PORT input value before the change
+ * @param val PORT input value after the change
  * @param param PORT that has a change
  */
-uint32_t GPIO_in_cb(int val, int param) {
+uint32_t GPIO_in_cb(uint32_t old_val, uint32_t val, uint32_t param) {
 
     uint32_t addr;
     uint32_t bit;
@@ -256,11 +239,9 @@ uint32_t GPIO_in_cb(int val, int param) {
             break;
     }
 
-    if ((memory[addr] & val) != 0) {
-        uint32_t aux = memory[ADDR_NVIC_IRQ];
-        aux |= bit;
-        memory[ADDR_NVIC_IRQ] = aux;
-        sem_post(&mutex_gpio);
+    /* Only pins that went from '0' to '1' trigger the IRQ */
+    if ((memory.peek(addr) & val & ~old_val) != 0) {
+        memory[ADDR_NVIC_IRQ].hw_fetch_or(bit);
     }
 
     return 0;
@@ -268,51 +249,225 @@ uint32_t GPIO_in_cb(int val, int param) {
 
 /**
  * @brief CB function to be called when TRACE register is updated
+ * @param old_val unused
  * @param val character written
  * @param param unused
  */
-uint32_t Trace_cb(int val, int param) {
+uint32_t Trace_cb(uint32_t old_val, uint32_t val, uint32_t param) {
+    (void) old_val;
     (void) param;
     gui_add_trace((char) (val & 0x00FF));
     return 0;
 }
 
-uint32_t send_to_uart(int value, int uart);
+/**
+ * @brief SRAM size in bytes
+ */
+static uint32_t sram_size = SRAM_DEFAULT_SIZE;
+
+/**
+ * @brief File with the Flash contents, nullptr for no Flash
+ */
+static const char *flash_file = nullptr;
+
+/**
+ * @brief Flash size in bytes
+ */
+static uint32_t flash_size = FLASH_DEFAULT_SIZE;
+
+/**
+ * @brief Write Flash changes back to #flash_file
+ */
+static bool flash_persistent = false;
+
+/**
+ * @brief Shared memory segment of the register file, nullptr if not exported
+ */
+static const char *shm_name = nullptr;
+
+/**
+ * @brief File for the bit coverage report, "-" for stdout, nullptr for no report
+ */
+static const char *coverage_file = nullptr;
+
+void SoC_MemoryConfig(uint32_t p_sram_size, const char *p_flash_file, uint32_t p_flash_size, bool p_flash_persistent) {
+    sram_size = p_sram_size;
+    flash_file = p_flash_file;
+    flash_size = p_flash_size;
+    flash_persistent = p_flash_persistent;
+}
+
+void SoC_ShmConfig(const char *name) {
+    shm_name = name;
+}
+
+void SoC_SpeedSet(double speed) {
+    events.set_speed(speed);
+}
+
+double SoC_SpeedGet() {
+    return events.speed();
+}
+
+void SoC_DeterministicConfig(uint64_t seed, const char *record_file, const char *replay_file) {
+    events.set_deterministic(seed, record_file, replay_file);
+}
+
+void SoC_ParseArgs(int argc, char *argv[]) {
+    bool deterministic = false;
+    uint64_t seed = 0;
+    const char *record_file = nullptr;
+    const char *replay_file = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--speed") == 0) && (i + 1 < argc)) {
+            i++;
+            if (strcmp(argv[i], "max") == 0) {
+                SoC_SpeedSet(0);
+            } else {
+                SoC_SpeedSet(atof(argv[i]));
+            }
+        } else if (strcmp(argv[i], "--deterministic") == 0) {
+            deterministic = true;
+        } else if ((strcmp(argv[i], "--seed") == 0) && (i + 1 < argc)) {
+            deterministic = true;
+            seed = strtoull(argv[++i], nullptr, 0);
+        } else if ((strcmp(argv[i], "--record") == 0) && (i + 1 < argc)) {
+            deterministic = true;
+            record_file = argv[++i];
+        } else if ((strcmp(argv[i], "--replay") == 0) && (i + 1 < argc)) {
+            deterministic = true;
+            replay_file = argv[++i];
+        } else if ((strcmp(argv[i], "--coverage") == 0) && (i + 1 < argc)) {
+            SoC_CoverageConfig(argv[++i]);
+        } else {
+            std::cout << "Unknown option " << argv[i] << ", use --speed <0.01..1000|max>, --deterministic, "
+                      << "--seed <n>, --record <file>, --replay <file> or --coverage <file|->\n";
+        }
+    }
+
+    if (deterministic) {
+        SoC_DeterministicConfig(seed, record_file, replay_file);
+    }
+}
+
+/**
+ * @brief FreeRTOS tick hook, the event queue interpolates virtual time inside the tick from it
+ */
+extern "C" void vApplicationTickHook(void) {
+    events.tick_hook();
+}
+
+void SoC_CoverageConfig(const char *file) {
+    coverage_file = file;
+}
+
+uint32_t SoC_MemoryPeek(uint32_t addr) {
+    return memory.peek(addr);
+}
+
+void SoC_MemoryPoke(uint32_t addr, uint32_t val) {
+    memory.poke(addr, val);
+}
+
+/**
+ * @brief Prints the register access and coverage reports and removes the shared memory name when the
+ * simulation ends
+ */
+static void SoC_Report() {
+    printf("Virtual time %.3f s, %.3f s skipped while idle\n", events.now() / 1e9, events.skipped() / 1e9);
+    if (PWR_residency(POWER_SLEEP) + PWR_residency(POWER_DEEP_SLEEP) != 0) {
+        printf("Power residency: run %.3f s, sleep %.3f s, deep sleep %.3f s\n", PWR_residency(POWER_RUN) / 1e9,
+               PWR_residency(POWER_SLEEP) / 1e9, PWR_residency(POWER_DEEP_SLEEP) / 1e9);
+    }
+    memory.report(stdout);
+    if ((coverage_file != nullptr) && (strcmp(coverage_file, "-") == 0)) {
+        memory.coverage_report(stdout);
+    } else if (coverage_file != nullptr) {
+        FILE *out = fopen(coverage_file, "w");
+
+        if (out == nullptr) {
+            perror(coverage_file);
+        } else {
+            memory.coverage_report(out);
+            fclose(out);
+        }
+    }
+    memory.unlink_shm();
+}
+
+/** Set by SIGINT or SIGTERM */
+static volatile sig_atomic_t stop_requested = 0;
+
+/** Posted by the signal handler, the stop thread waits for it */
+static sem_t stop_sem;
+
+/**
+ * @brief Asks the stop thread to end the simulation on Ctrl+C, so the exit report is printed
+ *
+ * Only async-signal-safe calls here: a second signal while the report is
+ * being printed quits at once.
+ * @param sig unused
+ */
+static void SoC_Stop(int sig) {
+    (void) sig;
+    if (stop_requested) {
+        _exit(EXIT_FAILURE);
+    }
+    stop_requested = 1;
+    sem_post(&stop_sem);
+}
+
+/**
+ * @brief Host thread that calls exit() out of the signal handler when a stop is requested
+ */
+static void SoC_StopThread() {
+    /* sem_wait() also returns when a signal interrupts it */
+    while (!stop_requested) {
+        (void) sem_wait(&stop_sem);
+    }
+    exit(EXIT_SUCCESS);
+}
 
 void SoC_Init() {
 
-    xTaskCreate(GPIO_IRQ_thread, "IRQ1", 10000, nullptr, 1, &GPIO_IRQ_handle);
-    xTaskCreate(RTC_IRQ_thread, "RTC", 10000, nullptr, 1, &RTC_IRQ_handle);
-    xTaskCreate(DAC_IRQ_thread, "DAC", 10000, nullptr, 1, &DAC_IRQ_handle);
-    xTaskCreate(UART_IRQ_thread, "UART", 10000, nullptr, 1, &UART_IRQ_handle);
-    //xTaskCreate(ADC_IRQ_thread, "ADC", 10000, nullptr, 1, &ADC_IRQ_handle);
-    xTaskCreate(WDT_thread, "WDT", 1000, nullptr, 1, &WDT_handle);
+    atexit(SoC_Report);
+    sem_init(&stop_sem, 0, 0);
+    std::thread(SoC_StopThread).detach();
+    signal(SIGINT, SoC_Stop);
+    signal(SIGTERM, SoC_Stop);
 
+    if (sram_size != 0) {
+        memory.add_ram(ADDR_SRAM_BASE, sram_size);
+    }
 
-    memory[ADDR_PORTA_IN].register_wr_cb(GPIO_in_cb, 1);
-    memory[ADDR_PORTB_IN].register_wr_cb(GPIO_in_cb, 2);
-    memory[ADDR_PORTC_IN].register_wr_cb(GPIO_in_cb, 3);
-    memory[ADDR_PORTD_IN].register_wr_cb(GPIO_in_cb, 4);
+    if (flash_file != nullptr) {
+        memory.add_flash(ADDR_FLASH_BASE, flash_size, flash_file, flash_persistent);
+    }
 
-    memory[ADDR_TRACE].register_wr_cb(Trace_cb, 0);
+    if (shm_name != nullptr) {
+        memory.set_shm_guard(SHM_enter, SHM_exit);
+        memory.export_shm(shm_name);
+    }
 
-    memory[ADDR_WDOG_CTRL].register_wr_cb(WDT_cb, 0);
-    memory[ADDR_WDOG_CMD].register_wr_cb(WDT_feed_cb, 5);
+    memory.set_pause(WATCH_pause, WATCH_resume);
 
-    memory[ADDR_ADC_DATA].register_rd_cb(ADC_data_cb, 0);
+    /* Host inputs, deterministic runs record and replay them by name */
+    events.add_input("gpio", GPIO_input);
+    events.add_input("adc", ADC_input);
+    events.add_input("uart_rx", UART::rxInput);
+    events.add_input("nvic", NVIC_input);
 
-    sem_init(&mutex_gpio, 0, 0);
+    events.start();
+    events.post_at(0, DAC_event);
 
-    UART_RX_IRQ = xSemaphoreCreateBinary();
-    WDT_Feed = xSemaphoreCreateBinary();
-    WDT_Enable = xSemaphoreCreateBinary();
+    xTaskCreate(NVIC_thread, "NVIC", 10000, nullptr, NVIC_TASK_PRIORITY, &nvic_task);
 
     uart0 = new UART(9600);
-
-    memory[ADDR_UART_TXDATA].register_wr_cb(send_to_uart, 0);
 }
 
-uint32_t send_to_uart(int value, int uart) {
+uint32_t send_to_uart(uint32_t old_value, uint32_t value, uint32_t uart) {
+    (void) old_value;
     (void) uart;
     uart0->send(value);
     return 0;
@@ -333,16 +488,12 @@ void SoC_Button1Pressed() {
         xSemaphoreGive(GUI_GPIO_IRQ);
     }
 #else
-    uint32_t aux = memory[ADDR_PORTA_IN];
-    aux |= (1 << BUTTON_1_PIN);
-    memory[ADDR_PORTA_IN] = aux;
+    GPIO_set_input(0, BUTTON_1_PIN, true);
 #endif
 }
 
 void SoC_Button1Released() {
-    uint32_t aux = memory[ADDR_PORTA_IN];
-    aux &= ~(1 << BUTTON_1_PIN);
-    memory[ADDR_PORTA_IN] = aux;
+    GPIO_set_input(0, BUTTON_1_PIN, false);
 }
 
 void SoC_Button2Pressed() {
@@ -355,21 +506,17 @@ void SoC_Button2Pressed() {
         xSemaphoreGive(GUI_GPIO_IRQ);
     }
 #else
-    uint32_t aux = memory[ADDR_PORTB_IN];
-    aux |= (1 << BUTTON_2_PIN);
-    memory[ADDR_PORTB_IN] = aux;
+    GPIO_set_input(1, BUTTON_2_PIN, true);
 #endif
 }
 
 void SoC_Button2Released() {
-    uint32_t aux = memory[ADDR_PORTB_IN];
-    aux &= ~(1 << BUTTON_2_PIN);
-    memory[ADDR_PORTB_IN] = aux;
+    GPIO_set_input(1, BUTTON_2_PIN, false);
 }
 
 bool SoC_LED1On() {
-    if (memory[ADDR_PORTC_CTRL] & (1 << LED_1_PIN)) {
-        if (memory[ADDR_PORTC_OUT] & (1 << LED_1_PIN)) {
+    if (memory.peek(ADDR_PORTC_CTRL) & (1 << LED_1_PIN)) {
+        if (memory.peek(ADDR_PORTC_OUT) & (1 << LED_1_PIN)) {
             return true;
         }
     }
@@ -379,8 +526,8 @@ bool SoC_LED1On() {
 
 bool SoC_LED2On() {
 
-    if (memory[ADDR_PORTD_CTRL] & (1 << LED_2_PIN)) {
-        if (memory[ADDR_PORTD_OUT] & (1 << LED_2_PIN)) {
+    if (memory.peek(ADDR_PORTD_CTRL) & (1 << LED_2_PIN)) {
+        if (memory.peek(ADDR_PORTD_OUT) & (1 << LED_2_PIN)) {
             return true;
         }
     }
@@ -392,8 +539,8 @@ bool SoC_LED2On() {
 unsigned int PWMDutyGet() {
     unsigned int duty;
 
-    if (memory[ADDR_TIMER_TOP] != 0) {
-        duty = 100U * memory[ADDR_TIMER_CMP] / memory[ADDR_TIMER_TOP];
+    if (memory.peek(ADDR_TIMER_TOP) != 0) {
+        duty = 100U * memory.peek(ADDR_TIMER_CMP) / memory.peek(ADDR_TIMER_TOP);
     } else {
         duty = 0;
     }
@@ -404,8 +551,9 @@ unsigned int PWMDutyGet() {
 unsigned int PWMFreqGet() {
     unsigned int freq;
 
-    if (memory[ADDR_TIMER_TOP] != 0) {
-        freq = TimerFreqGet() / memory[ADDR_TIMER_TOP];
+    /* The counter goes through TOP + 1 values per period */
+    if (memory.peek(ADDR_TIMER_TOP) != 0) {
+        freq = TimerFreqGet() / (memory.peek(ADDR_TIMER_TOP) + 1);
     } else {
         freq = 0;
     }
@@ -424,41 +572,432 @@ unsigned int TimerFreqGet() {
     return freq;
 }
 
-/******************** RTC *******************/
+/** TIMER_CTRL enable bit */
+#define TIMER_CTRL_ENABLE (0x01)
 
-[[noreturn]] void RTC_IRQ_thread(void *parameters) {
-    (void) parameters;
-    TickType_t pxPreviousWakeTime;
+/** TIMER_CTRL overflow IRQ enable bit */
+#define TIMER_CTRL_OVF_IRQ (0x02)
 
-    pxPreviousWakeTime = xTaskGetTickCount();
-    uint32_t now = 0;
+/** TIMER_CTRL compare IRQ enable bit */
+#define TIMER_CTRL_CMP_IRQ (0x04)
 
-    while (true) {
+/**
+ * @brief Timer count parameters, TIMER_CNT is computed from them when read
+ *
+ * CNT = (base + counts since start) % (TOP + 1). Changing the prescaler, the
+ * enable bit or TOP restarts the count from its current value. Compare and
+ * overflow interrupts are events at the time of the count that raises them,
+ * the timer does not run an event per count.
+ */
+struct TimerCount {
+    uint64_t start;     /**< Virtual time the count started from base, in ns */
+    uint32_t base;      /**< Counter value at start */
+    uint32_t prescaler; /**< Prescaler while the timer counts, 0 while stopped */
+    uint32_t top;       /**< TOP value the count started with */
+};
+
+/**
+ * @brief Timer count, changed by the tasks with the scheduler suspended (EventLock)
+ *
+ * TIMER_CNT reads and the GUI use timer_host instead, they take no lock.
+ */
+static TimerCount timer = {};
+
+/** Copy of timer for the reads, published on every change */
+static HostCopy<TimerCount> timer_host;
+
+/** Compare or overflow event, -1 if none */
+static int timer_event = -1;
+
+/** Identifies the current timer event, a stale one may already be running when it is moved */
+static uint32_t timer_gen = 0;
+
+/** Counts since timer.start of the count that raises the current timer event */
+static uint64_t timer_event_counts = 0;
+
+/**
+ * @brief Counts since the start of a count at a virtual time
+ * @param t timer count
+ * @param now virtual time in ns
+ */
+static uint64_t TIMER_counts(const TimerCount &t, uint64_t now) {
+    if ((t.prescaler == 0) || (now <= t.start)) {
+        return 0;
+    }
+    /* TIMER_IN_FREQ counts per second: 16 counts every 1000 ns */
+    return (now - t.start) * (TIMER_IN_FREQ / 1000000) / (1000ULL * t.prescaler);
+}
+
+/**
+ * @brief Virtual time of a count
+ * @param t timer count
+ * @param counts counts since t.start
+ * @return virtual time in ns
+ */
+static uint64_t TIMER_time(const TimerCount &t, uint64_t counts) {
+    uint64_t num = counts * 1000ULL * t.prescaler;
+
+    return t.start + (num + (TIMER_IN_FREQ / 1000000) - 1) / (TIMER_IN_FREQ / 1000000);
+}
+
+/**
+ * @brief Timer counter value at a virtual time
+ * @param t timer count
+ * @param now virtual time in ns
+ */
+static uint32_t TIMER_count(const TimerCount &t, uint64_t now) {
+    return (uint32_t) ((t.base + TIMER_counts(t, now)) % ((uint64_t) t.top + 1));
+}
+
+/**
+ * @brief Counts until the counter becomes a value
+ * @param t timer count
+ * @param counts counts since t.start of the current count
+ * @param target counter value, at most t.top
+ * @return counts, a full period if the counter already has the value
+ */
+static uint64_t TIMER_counts_to(const TimerCount &t, uint64_t counts, uint32_t target) {
+    uint64_t period = (uint64_t) t.top + 1;
+    uint64_t cur = (t.base + counts) % period;
+    uint64_t ahead = (target + period - cur) % period;
+
+    return (ahead == 0) ? period : ahead;
+}
+
+static void TIMER_event(uint32_t gen);
+
+/**
+ * @brief Finds the next compare match or overflow with its IRQ enabled and cancels the current event, scheduler suspended
+ *
+ * The event is posted by TIMER_post() once the scheduler is resumed: posting
+ * wakes up the event task, a kernel call made outside the EventLock.
+ * @param counts counts since timer.start of the last count already handled
+ * @param when set to the virtual time of the event
+ * @param gen set to the timer_gen of the event
+ * @return true if there is an event to post
+ */
+static bool TIMER_schedule(uint64_t counts, uint64_t *when, uint32_t *gen) {
+    uint32_t ctrl = memory.peek(ADDR_TIMER_CTRL);
+    uint32_t cmp = memory.peek(ADDR_TIMER_CMP);
+    bool ovf_irq = ctrl & TIMER_CTRL_OVF_IRQ;
+    bool cmp_irq = (ctrl & TIMER_CTRL_CMP_IRQ) && (cmp <= timer.top);
+
+    if (timer_event >= 0) {
+        events.cancel(timer_event);
+        timer_event = -1;
+    }
+    timer_gen++;
+    if ((timer.prescaler == 0) || (timer.top == 0) || (!ovf_irq && !cmp_irq)) {
+        return false;
+    }
+
+    uint64_t ahead = ovf_irq ? TIMER_counts_to(timer, counts, 0) : UINT64_MAX;
+    if (cmp_irq) {
+        ahead = std::min(ahead, TIMER_counts_to(timer, counts, cmp));
+    }
+    timer_event_counts = counts + ahead;
+    *when = TIMER_time(timer, timer_event_counts);
+    *gen = timer_gen;
+    return true;
+}
+
+/**
+ * @brief Posts the event found by TIMER_schedule(), scheduler running
+ * @param when virtual time of the event
+ * @param gen timer_gen of the event
+ */
+static void TIMER_post(uint64_t when, uint32_t gen) {
+    int id = events.post_at(when, TIMER_event, gen);
+    EventLock lock;
+
+    /* Rescheduled meanwhile, the event is already stale */
+    if (gen == timer_gen) {
+        timer_event = id;
+    } else {
+        events.cancel(id);
+    }
+}
+
+/**
+ * @brief Timer compare match or overflow event
+ * @param gen timer_gen when it was posted
+ */
+static void TIMER_event(uint32_t gen) {
+    uint32_t irqs = 0;
+    uint64_t when;
+    bool post;
 
-        if (memory[ADDR_RTC_CTRL] & 0x01) {
-            memory[ADDR_RTC_CNT] = now;
+    {
+        EventLock lock;
+
+        if (gen != timer_gen) {
+            return;
         }
+        timer_event = -1;
 
-        if (memory[ADDR_RTC_CTRL] & 0x00000080) {
-            if (memory[ADDR_RTC_CNT] == memory[ADDR_RTC_CMP]) {
-#if 1
-                memory[ADDR_NVIC_IRQ] |= NVIC_RTC_IRQ_BIT;
-#else
-                uint32_t aux = memory[ADDR_NVIC_IRQ];
-                aux |= NVIC_RTC_IRQ_BIT;
-                memory[ADDR_NVIC_IRQ] = aux;
-#endif
-            }
+        uint32_t ctrl = memory.peek(ADDR_TIMER_CTRL);
+        uint32_t cnt = (uint32_t) ((timer.base + timer_event_counts) % ((uint64_t) timer.top + 1));
+        if ((ctrl & TIMER_CTRL_OVF_IRQ) && (cnt == 0)) {
+            irqs |= NVIC_TIMER_OVF_IRQ_BIT;
         }
+        if ((ctrl & TIMER_CTRL_CMP_IRQ) && (cnt == memory.peek(ADDR_TIMER_CMP))) {
+            irqs |= NVIC_TIMER_CMP_IRQ_BIT;
+        }
+        post = TIMER_schedule(timer_event_counts, &when, &gen);
+    }
+
+    if (post) {
+        TIMER_post(when, gen);
+    }
+    if (irqs != 0) {
+        memory[ADDR_NVIC_IRQ].hw_fetch_or(irqs);
+    }
+}
 
-        if (memory[ADDR_NVIC_IRQ] & NVIC_RTC_IRQ_BIT) {
-            RTC_ISR();
+uint32_t TIMER_cb(uint32_t old_val, uint32_t val, uint32_t param) {
+    (void) old_val;
+    (void) val;
+    (void) param;
+    uint64_t when;
+    uint32_t gen;
+    bool post;
+
+    {
+        EventLock lock;
+        uint64_t now = events.now();
+        uint32_t ctrl = memory.peek(ADDR_TIMER_CTRL);
+        uint32_t prescaler = (ctrl & TIMER_CTRL_ENABLE) ? (ctrl >> TIMER_CTRL_PRESCALER_SHIFT) & 0xFFF : 0;
+        uint32_t top = memory.peek(ADDR_TIMER_TOP);
+
+        /* IRQ enables and CMP only move the next event, the count keeps its phase */
+        if ((prescaler == timer.prescaler) && (top == timer.top)) {
+            post = TIMER_schedule(TIMER_counts(timer, now), &when, &gen);
+        } else {
+            uint32_t base = TIMER_count(timer, now);
+
+            timer = {now, (base > top) ? 0 : base, prescaler, top};
+            timer_host.publish(timer);
+            memory.poke(ADDR_TIMER_CNT, timer.base);
+            post = TIMER_schedule(0, &when, &gen);
         }
+    }
+
+    if (post) {
+        TIMER_post(when, gen);
+    }
+    return 0;
+}
+
+uint32_t TIMER_rd_cb(uint32_t val, uint32_t param) {
+    (void) val;
+    (void) param;
+
+    return TIMER_count(timer_host.read(), events.now());
+}
+
+bool PWMOutputAt(uint64_t time) {
+    return TIMER_count(timer_host.read(), time) >= memory.peek(ADDR_TIMER_CMP);
+}
+
+uint64_t PWMNextEdge(uint64_t time) {
+    TimerCount t = timer_host.read();
+    uint32_t cmp = memory.peek(ADDR_TIMER_CMP);
+
+    /* With CMP 0 the output is always '1', above TOP always '0' */
+    if ((t.prescaler == 0) || (t.top == 0) || (cmp == 0) || (cmp > t.top)) {
+        return UINT64_MAX;
+    }
+    uint64_t counts = TIMER_counts(t, time);
+    uint64_t ahead = std::min(TIMER_counts_to(t, counts, 0), TIMER_counts_to(t, counts, cmp));
+
+    return TIMER_time(t, counts + ahead);
+}
+
+/******************** RTC *******************/
 
-        /* Check every 1 s. */
-        now++;
-        xTaskDelayUntil(&pxPreviousWakeTime, 1000);
+/** RTC counter period, 1 s */
+#define RTC_PERIOD_NS (1000 * EVENT_NS_PER_MS)
+
+/** RTC_CTRL enable bit */
+#define RTC_CTRL_ENABLE (0x01)
+
+/** RTC_CTRL IRQ enable bit */
+#define RTC_CTRL_IRQ (0x80)
+
+/**
+ * @brief RTC count parameters, RTC_CNT is computed from them when read
+ *
+ * CNT = base + seconds since start while the RTC is enabled, so there is no
+ * event every second: the compare match is an event at the time the count
+ * reaches RTC_CMP.
+ */
+struct RtcCount {
+    uint64_t start;     /**< Virtual time the count started from base, in ns */
+    uint32_t base;      /**< Counter value at start */
+    bool running;       /**< The RTC counts */
+};
+
+/**
+ * @brief RTC count, changed by the tasks with the scheduler suspended (EventLock)
+ *
+ * RTC_CNT reads and the GUI use rtc_host instead, they take no lock.
+ */
+static RtcCount rtc = {};
+
+/** Copy of rtc for the reads, published on every change */
+static HostCopy<RtcCount> rtc_host;
+
+/** Compare match event, -1 if none */
+static int rtc_match_event = -1;
+
+/** Identifies the current compare match event, a stale one may already be running when it is moved */
+static uint32_t rtc_match_gen = 0;
+
+/**
+ * @brief RTC counter value at a virtual time
+ * @param r RTC count
+ * @param now virtual time in ns
+ */
+static uint32_t RTC_count(const RtcCount &r, uint64_t now) {
+    if (!r.running || (now <= r.start)) {
+        return r.base;
     }
+    return r.base + (uint32_t) ((now - r.start) / RTC_PERIOD_NS);
+}
+
+static void RTC_match(uint32_t gen);
+
+/**
+ * @brief Finds the time the count reaches RTC_CMP and cancels the current compare match event, scheduler suspended
+ *
+ * The event is posted by RTC_post() once the scheduler is resumed, see TIMER_schedule().
+ * @param now virtual time in ns
+ * @param when set to the virtual time of the compare match
+ * @param gen set to the rtc_match_gen of the event
+ * @return true if there is an event to post
+ */
+static bool RTC_schedule(uint64_t now, uint64_t *when, uint32_t *gen) {
+    if (rtc_match_event >= 0) {
+        events.cancel(rtc_match_event);
+        rtc_match_event = -1;
+    }
+    rtc_match_gen++;
+    if (!rtc.running || !(memory.peek(ADDR_RTC_CTRL) & RTC_CTRL_IRQ)) {
+        return false;
+    }
+
+    /* The count matches when it becomes equal, if it already is the next match is after wrapping around */
+    uint64_t elapsed = (now > rtc.start) ? (now - rtc.start) / RTC_PERIOD_NS : 0;
+    uint64_t ahead = (uint32_t) (memory.peek(ADDR_RTC_CMP) - (rtc.base + (uint32_t) elapsed));
+    if (ahead == 0) {
+        ahead = 1ULL << 32;
+    }
+    *when = rtc.start + (elapsed + ahead) * RTC_PERIOD_NS;
+    *gen = rtc_match_gen;
+    return true;
+}
+
+/**
+ * @brief Posts the event found by RTC_schedule(), scheduler running
+ * @param when virtual time of the compare match
+ * @param gen rtc_match_gen of the event
+ */
+static void RTC_post(uint64_t when, uint32_t gen) {
+    int id = events.post_at(when, RTC_match, gen);
+    EventLock lock;
+
+    /* Rescheduled meanwhile, the event is already stale */
+    if (gen == rtc_match_gen) {
+        rtc_match_event = id;
+    } else {
+        events.cancel(id);
+    }
+}
+
+/**
+ * @brief RTC compare match event
+ * @param gen rtc_match_gen when it was posted
+ */
+static void RTC_match(uint32_t gen) {
+    uint64_t when;
+    bool post;
+
+    {
+        EventLock lock;
+
+        if (gen != rtc_match_gen) {
+            return;
+        }
+        rtc_match_event = -1;
+        post = RTC_schedule(events.now(), &when, &gen);
+    }
+
+    if (post) {
+        RTC_post(when, gen);
+    }
+    memory[ADDR_NVIC_IRQ].hw_fetch_or(NVIC_RTC_IRQ_BIT);
+}
+
+uint32_t RTC_cb(uint32_t old_val, uint32_t val, uint32_t param) {
+    (void) old_val;
+    (void) val;
+    (void) param;
+    uint64_t when;
+    uint32_t gen;
+    bool post;
+
+    {
+        EventLock lock;
+        uint64_t now = events.now();
+        bool enable = memory.peek(ADDR_RTC_CTRL) & RTC_CTRL_ENABLE;
+
+        /* Enabling starts a new second, disabling freezes the count */
+        if (enable != rtc.running) {
+            rtc = {now, RTC_count(rtc, now), enable};
+            rtc_host.publish(rtc);
+            memory.poke(ADDR_RTC_CNT, rtc.base);
+        }
+        post = RTC_schedule(now, &when, &gen);
+    }
+
+    if (post) {
+        RTC_post(when, gen);
+    }
+    return 0;
+}
+
+uint32_t RTC_set_cb(uint32_t old_val, uint32_t val, uint32_t param) {
+    (void) old_val;
+    (void) param;
+    uint64_t when;
+    uint32_t gen;
+    bool post;
+
+    {
+        EventLock lock;
+        uint64_t now = events.now();
+
+        rtc.base = val;
+        rtc.start = now;
+        rtc_host.publish(rtc);
+        post = RTC_schedule(now, &when, &gen);
+    }
+
+    if (post) {
+        RTC_post(when, gen);
+    }
+    return 0;
+}
+
+uint32_t RTC_rd_cb(uint32_t val, uint32_t param) {
+    (void) val;
+    (void) param;
+
+    return RTC_count(rtc_host.read(), events.now());
+}
+
+unsigned int RTCCountGet() {
+    return RTC_count(rtc_host.read(), events.host_now());
 }
 
 /************************ DAC ***********************/
@@ -497,31 +1036,33 @@ float get_DACVal(void *data, int idx) {
     return DACValues[idx];
 }
 
-[[noreturn]] void DAC_IRQ_thread(void *parameters) {
-    (void) parameters;
-    TickType_t pxPreviousWakeTime;
+/** DAC conversion period, 200 ms */
+#define DAC_PERIOD_NS (200 * EVENT_NS_PER_MS)
 
-    pxPreviousWakeTime = xTaskGetTickCount();
-    while (true) {
+/**
+ * @brief Virtual time of the next DAC conversion
+ */
+static uint64_t dac_next = 0;
 
-        if (memory[ADDR_DAC_CTRL] & 0x01) {
-            uint32_t dac_data = memory[ADDR_DAC_DATA];
-            dac_data = dac_data & 0x00000FFF;   // DAC uses only 12 bits
-            insert_DACVal((float) dac_data);
+/**
+ * @brief DAC event, converts a sample
+ * @param param unused
+ */
+static void DAC_event(uint32_t param) {
+    (void) param;
 
-            if (memory[ADDR_DAC_CTRL] & 0x00000080) {
-                uint32_t aux = memory[ADDR_NVIC_IRQ];
-                aux |= NVIC_DAC_IRQ_BIT;
-                memory[ADDR_NVIC_IRQ] = aux;
-            }
-        }
+    if (memory.peek(ADDR_DAC_CTRL) & 0x01) {
+        uint32_t dac_data = memory.peek(ADDR_DAC_DATA);
+        dac_data = dac_data & 0x00000FFF;   // DAC uses only 12 bits
+        insert_DACVal((float) dac_data);
 
-        if (memory[ADDR_NVIC_IRQ] & NVIC_DAC_IRQ_BIT) {
-            DAC_ISR();
+        if (memory.peek(ADDR_DAC_CTRL) & 0x00000080) {
+            memory[ADDR_NVIC_IRQ].hw_fetch_or(NVIC_DAC_IRQ_BIT);
         }
-
-        xTaskDelayUntil(&pxPreviousWakeTime, 200);
     }
+
+    dac_next += DAC_PERIOD_NS;
+    events.post_at(dac_next, DAC_event);
 }
 
 /******************** UART **********************/
@@ -531,7 +1072,9 @@ uint16_t UART_GetBaudRate() {
 }
 
 void UART_NotifyRxData() {
-    xSemaphoreGive(UART_RX_IRQ);
+    if (memory.peek(ADDR_UART_CTRL) & 0x00000080) {
+        memory[ADDR_NVIC_IRQ].hw_fetch_or(NVIC_UART_IRQ_BIT);
+    }
 }
 
 const char *getUART_Path() {
@@ -539,52 +1082,34 @@ const char *getUART_Path() {
 }
 
 
-[[noreturn]] void UART_IRQ_thread(void *parameters) {
-    (void) parameters;
-
-    while (true) {
-
-        if (xSemaphoreTake(UART_RX_IRQ, portMAX_DELAY)) {
-
-            if (memory[ADDR_UART_CTRL] & 0x00000080) {
-                uint32_t aux = memory[ADDR_NVIC_IRQ];
-                aux |= NVIC_UART_IRQ_BIT;
-                memory[ADDR_NVIC_IRQ] = aux;
-            }
-        }
-
-        if (memory[ADDR_NVIC_IRQ] & NVIC_UART_IRQ_BIT) {
-            UART_RX_ISR();
-        }
-    }
-}
-
 /******************** ADC **********************/
 
 uint16_t ADC_values[2] = {0};
 
-[[noreturn]] void ADC_IRQ_thread(void *parameters) {
-    (void) parameters;
-    while (true) {
-
-    }
+/**
+ * @brief Host input that sets the value of an ADC channel
+ * @param param channel << 16 | value
+ */
+static void ADC_input(uint32_t param) {
+    ADC_values[param >> 16] = param & 0xFFFF;
 }
 
 void ADCSetValue(int ch, uint16_t value) {
-    if (ch < 2) {
-        ADC_values[ch] = value;
+    /* The GUI sets the sliders on every frame, only changes are inputs */
+    if ((ch >= 0) && (ch < 2) && (ADC_values[ch] != value)) {
+        events.input(ADC_input, ((uint32_t) ch << 16) | value);
     }
 }
 
-uint32_t ADC_data_cb(int val, int param) {
+uint32_t ADC_data_cb(uint32_t val, uint32_t param) {
     (void) param;
     uint32_t mode;
     uint32_t aux;
     uint32_t ch;
 
-    mode = ( memory[ADDR_ADC_CTRL] >> 1 ) & 0x0000000F;
+    mode = ( memory.peek(ADDR_ADC_CTRL) >> 1 ) & 0x0000000F;
 
-    aux = memory[ADDR_ADC_ADMUX];
+    aux = memory.peek(ADDR_ADC_ADMUX);
     ch = (aux >> 2);
 
     if (mode == SINGLE) {
@@ -602,59 +1127,481 @@ uint32_t ADC_data_cb(int val, int param) {
     } else {
         val = ADC_values[0] - ADC_values[1];
     }
-    std::cout << "ADC val " << val << '\n';
+    std::cout << "ADC val " << (int32_t) val << '\n';
     return val;
 }
 
+/******************** Bus fault **********************/
+
+void SoC_BusFaultIRQ(uint32_t addr, bool write) {
+    memory[ADDR_NVIC_IRQ].hw_fetch_or(NVIC_BUSFAULT_IRQ_BIT);
+
+    if (BUS_FAULT_ISR) {
+        BUS_FAULT_ISR(addr, write);
+    } else {
+        std::cout << "Bus fault IRQ without BUS_FAULT_ISR at 0x" << std::hex << addr << std::dec << '\n';
+    }
+}
+
+/******************** Shared memory **********************/
+
+/**
+ * @brief Keeps the other tasks out while a task holds a sequence lock of the shared memory
+ *
+ * A task switched out with the counter odd would leave the other writers of
+ * the block spinning forever. Host threads are never switched out, they go
+ * through.
+ */
+static void SHM_enter() {
+    if (!EventQueue::host_thread() && (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED)) {
+        taskENTER_CRITICAL();
+    }
+}
+
+/**
+ * @brief Leaves the critical section of SHM_enter()
+ */
+static void SHM_exit() {
+    if (!EventQueue::host_thread() && (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED)) {
+        taskEXIT_CRITICAL();
+    }
+}
+
+/******************** Watchpoints **********************/
+
+/**
+ * @brief Semaphores of the tasks stopped by WatchAction::Pause watchpoints, under EventLock
+ */
+static std::vector<SemaphoreHandle_t> watch_waiters;
+
+/**
+ * @brief Stops the calling task on a WatchAction::Pause watchpoint until WATCH_resume()
+ * @return false if the caller is not a firmware task or holds the scheduler
+ */
+static bool WATCH_pause() {
+    /* The event task runs the resume, it must never stop */
+    if (EventQueue::host_thread() || (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING) || events.event_task()) {
+        return false;
+    }
+
+    SemaphoreHandle_t resume = xSemaphoreCreateBinary();
+
+    {
+        EventLock lock;
+        watch_waiters.push_back(resume);
+    }
+
+    /* A resume before the take is kept by the semaphore */
+    xSemaphoreTake(resume, portMAX_DELAY);
+    vSemaphoreDelete(resume);
+    return true;
+}
+
+/**
+ * @brief Restarts the tasks stopped by watchpoints, on the event task
+ */
+static void WATCH_resume_event(uint32_t) {
+    std::vector<SemaphoreHandle_t> resumed;
+
+    {
+        EventLock lock;
+        resumed.swap(watch_waiters);
+    }
+
+    for (auto resume : resumed) {
+        xSemaphoreGive(resume);
+    }
+}
+
+/**
+ * @brief Restarts the tasks stopped by watchpoints, the GUI goes through the event task
+ */
+static void WATCH_resume() {
+    if (EventQueue::host_thread()) {
+        events.host_call(WATCH_resume_event);
+    } else {
+        WATCH_resume_event(0);
+    }
+}
+
 /******************** WDT **********************/
 
 /**
- * @brief Watchdog task thread
- * @param parameters unused
+ * @brief Pending watchdog time-out event, -1 if the watchdog is not counting
  */
-[[noreturn]] void WDT_thread(void *parameters) {
-    (void) parameters;
+static std::atomic<int> wdt_event(-1);
 
-    while (true) {
+/**
+ * @brief Watchdog time-out event
+ * @param param unused
+ */
+static void WDT_timeout(uint32_t param) {
+    (void) param;
+    wdt_event.store(-1);
 
-        xSemaphoreTake(WDT_Enable, portMAX_DELAY);
-        bool enabled;
-        do {
-            /* if enabled, start count-down */
-            enabled = memory[ADDR_WDOG_CTRL] & 0x00000001;
-            if (enabled) {
-                unsigned int wdt_time = (memory[ADDR_WDOG_CTRL] >> WDT_CTRL_PRESCALER_SHIFT) & 0x0000000F;
-                wdt_time = (1 << wdt_time) * 16;
-                if (xSemaphoreTake (WDT_Feed, wdt_time / portTICK_PERIOD_MS) == pdFALSE) {
-                    /* Time-out, nobody has feed us, we are angry and bit the bone */
-                    std::cout << "********************* WDT RESET !!! ************************\n" << std::endl;
-                    vTaskEndScheduler();
-                } else {
-                    /* Somebody feed the watchdog, nothings happens */
-                }
+    if (memory.peek(ADDR_WDOG_CTRL) & 0x00000001) {
+        /* Time-out, nobody has feed us, we are angry and bit the bone */
+        std::cout << "********************* WDT RESET !!! ************************\n" << std::endl;
+        vTaskEndScheduler();
+    }
+}
+
+/**
+ * @brief Starts the watchdog count-down again
+ */
+static void WDT_restart() {
+    int old_event = wdt_event.exchange(-1);
+
+    if (old_event >= 0) {
+        events.cancel(old_event);
+    }
+
+    unsigned int wdt_time = (memory.peek(ADDR_WDOG_CTRL) >> WDT_CTRL_PRESCALER_SHIFT) & 0x0000000F;
+    wdt_time = (1 << wdt_time) * 16;
+    wdt_event.store(events.post_in(wdt_time * EVENT_NS_PER_MS, WDT_timeout));
+}
+
+uint32_t WDT_cb(uint32_t old_val, uint32_t val, uint32_t param) {
+    (void) old_val;
+    (void) val;
+    (void) param;
+
+    /* Writes while counting do not restart the count-down */
+    if ((memory.peek(ADDR_WDOG_CTRL) & 0x00000001) && (wdt_event.load() < 0)) {
+        WDT_restart();
+    }
+
+    return 0;
+}
+
+uint32_t WDT_feed_cb(uint32_t old_val, uint32_t val, uint32_t param) {
+    (void) old_val;
+    (void) param;
+    if ((val == 0x00505345) && (wdt_event.load() >= 0)) {
+        WDT_restart();
+    }
+
+    return 0;
+}
+
+/******************** Power **********************/
+
+/**
+ * @brief Task sleeping until an IRQ
+ */
+struct PWR_waiter {
+    SemaphoreHandle_t wake;     /**< given by the IRQ that wakes the task up */
+    int mode;                   /**< POWER_SLEEP or POWER_DEEP_SLEEP */
+};
+
+/**
+ * @brief Tasks in HAL_WFI() or HAL_DeepSleep(), changed with the scheduler suspended (EventLock)
+ *
+ * The sleeping tasks, the IRQ path and the idle task all use it, a host
+ * mutex held by a suspended task would hang the idle or the event task.
+ */
+static std::vector<PWR_waiter> pwr_waiters;
+
+/**
+ * @brief Idle time spent in each power mode in ns, the run time is the rest
+ */
+static std::atomic<uint64_t> pwr_residency[POWER_DEEP_SLEEP + 1];
+
+void SoC_WaitForInterrupt(int mode) {
+    uint32_t mask = (mode == POWER_DEEP_SLEEP) ? memory.peek(ADDR_PWR_WAKE) : 0xFFFFFFFF;
+
+    /* No IRQ would ever wake the task up, sleep as WFI instead */
+    if (mask == 0) {
+        static std::atomic<bool> warned(false);
+
+        if (!warned.exchange(true)) {
+            std::cout << "HAL_DeepSleep() with no wake source in PWR_WAKE, sleeping as HAL_WFI()\n";
+        }
+        mode = POWER_SLEEP;
+        mask = 0xFFFFFFFF;
+    }
+
+    SemaphoreHandle_t wake = xSemaphoreCreateBinary();
+    bool pending;
+
+    {
+        EventLock lock;
+
+        /* As WFI, a pending IRQ does not let the task sleep. NVIC_IRQ_cb() runs after the bit is set */
+        pending = (memory.peek(ADDR_NVIC_IRQ) & memory.peek(ADDR_NVIC_CTRL) & mask) != 0;
+        if (!pending) {
+            pwr_waiters.push_back({wake, mode});
+        }
+    }
+
+    /* The IRQ may come before the take, the semaphore keeps it */
+    if (!pending) {
+        xSemaphoreTake(wake, portMAX_DELAY);
+    }
+    vSemaphoreDelete(wake);
+}
+
+/**
+ * @brief Wakes up the tasks sleeping until one of the IRQs raised
+ * @param raised enabled IRQs that became pending
+ */
+static void PWR_wake(uint32_t raised) {
+    std::vector<SemaphoreHandle_t> woken;
+
+    {
+        EventLock lock;
+        bool deep_wake = (raised & memory.peek(ADDR_PWR_WAKE)) != 0;
+
+        for (auto it = pwr_waiters.begin(); it != pwr_waiters.end();) {
+            if ((it->mode == POWER_SLEEP) || deep_wake) {
+                woken.push_back(it->wake);
+                it = pwr_waiters.erase(it);
+            } else {
+                ++it;
             }
-        } while (enabled);
+        }
+    }
 
+    /* Giving may switch to the woken task, so with the scheduler running */
+    for (auto wake : woken) {
+        xSemaphoreGive(wake);
     }
 }
 
-uint32_t WDT_cb(int val, int param) {
+/**
+ * @brief Power mode of the idle time, the lightest one of the sleeping tasks
+ * @return POWER_RUN if no task sleeps
+ */
+static int PWR_idle_mode() {
+    EventLock lock;
+    int mode = POWER_RUN;
+
+    for (const auto &waiter : pwr_waiters) {
+        if (waiter.mode == POWER_SLEEP) {
+            return POWER_SLEEP;
+        }
+        mode = POWER_DEEP_SLEEP;
+    }
+
+    return mode;
+}
+
+/**
+ * @brief Adds idle time to the residency of a power mode
+ * @param mode power mode of the idle time
+ * @param ticks ticks stepped over
+ */
+static void PWR_account(int mode, TickType_t ticks) {
+    if (mode != POWER_RUN) {
+        pwr_residency[mode].fetch_add(ticks * EVENT_NS_PER_TICK, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Virtual time spent in a power mode
+ * @param mode power mode
+ * @return time in ns
+ */
+static uint64_t PWR_residency(int mode) {
+    if (mode == POWER_RUN) {
+        uint64_t now = events.now();
+        uint64_t asleep = PWR_residency(POWER_SLEEP) + PWR_residency(POWER_DEEP_SLEEP);
+
+        return now - std::min(now, asleep);
+    }
+
+    return pwr_residency[mode].load(std::memory_order_relaxed);
+}
+
+uint32_t PWR_rd_cb(uint32_t val, uint32_t param) {
     (void) val;
+
+    return (uint32_t) (PWR_residency(param) / EVENT_NS_PER_MS);
+}
+
+void SoC_SuppressTicks(unsigned long expected_idle) {
+    int mode = PWR_idle_mode();
+
+    /* A sleeping core waits for nothing but the next timeout or event, it is skipped at any speed */
+    PWR_account(mode, events.idle(expected_idle, mode != POWER_RUN));
+}
+
+/**
+ * @brief FreeRTOS idle hook, deterministic runs step short idle times from it
+ */
+extern "C" void vApplicationIdleHook(void) {
+    if (events.deterministic()) {
+        int mode = PWR_idle_mode();
+
+        PWR_account(mode, events.idle_hook(mode != POWER_RUN));
+    }
+}
+
+/******************** NVIC **********************/
+
+/** Priority of the ISRs running in the dispatcher, NVIC_PRIO_LEVELS when none */
+static std::atomic<int> nvic_running_prio(NVIC_PRIO_LEVELS);
+
+/** The calling thread is the dispatcher running an ISR */
+static thread_local bool nvic_in_isr = false;
+
+/**
+ * @brief ISR of an IRQ
+ * @param irq IRQ number
+ * @return ISR defined by the firmware, nullptr if none. The bus fault ISR runs in the faulting context
+ */
+static void (*NVIC_vector(uint32_t irq))(void) {
+    switch (irq) {
+        case NVIC_PORTA_IRQ_NUM:
+            return PORT_A_ISR;
+        case NVIC_PORTB_IRQ_NUM:
+            return PORT_B_ISR;
+        case NVIC_TIMER_OVF_IRQ_NUM:
+            return TIMER_OVF_ISR;
+        case NVIC_TIMER_CMP_IRQ_NUM:
+            return TIMER_CMP_ISR;
+        case NVIC_RTC_IRQ_NUM:
+            return RTC_ISR;
+        case NVIC_DAC_IRQ_NUM:
+            return DAC_ISR;
+        case NVIC_UART_IRQ_NUM:
+            return UART_RX_ISR;
+        default:
+            return nullptr;
+    }
+}
+
+/**
+ * @brief Priority of an IRQ, 4 bits per IRQ in NVIC_PRIO0 to NVIC_PRIO3
+ * @param irq IRQ number
+ * @return priority, 0 is the highest
+ */
+static int NVIC_priority(uint32_t irq) {
+    uint32_t prio = memory.peek(ADDR_NVIC_PRIO0 + (irq / NVIC_PRIO_PER_REG) * sizeof(uint32_t));
+
+    return (prio >> ((irq % NVIC_PRIO_PER_REG) * NVIC_PRIO_BITS)) & (NVIC_PRIO_LEVELS - 1);
+}
+
+/**
+ * @brief Warns once about a pending IRQ that has no ISR to run, dispatcher task only
+ *
+ * Its bit stays set in NVIC_IRQ, the firmware may poll and clear it. The bus
+ * fault IRQ is left out, its ISR runs in the faulting context.
+ * @param irq IRQ number
+ */
+static void NVIC_unhandled(uint32_t irq) {
+    static uint32_t warned = 0;
+
+    if ((irq != NVIC_BUSFAULT_IRQ_NUM) && !(warned & (1U << irq))) {
+        warned |= 1U << irq;
+        std::cout << "IRQ #" << irq << " pending without ISR, it stays set in NVIC_IRQ\n";
+    }
+}
+
+/**
+ * @brief Runs the pending and enabled ISRs that preempt the running one, highest priority first
+ *
+ * Ties go to the lowest IRQ number. The pending bit is cleared and the active
+ * bit set while the ISR runs, an IRQ raised again meanwhile runs after it.
+ */
+static void NVIC_dispatch() {
+    int running = nvic_running_prio.load(std::memory_order_relaxed);
+
+    while (true) {
+        uint32_t ready = memory.peek(ADDR_NVIC_IRQ) & memory.peek(ADDR_NVIC_CTRL);
+        void (*isr)(void) = nullptr;
+        int best_prio = running;
+        uint32_t best = 0;
+
+        for (; ready != 0; ready &= ready - 1) {
+            uint32_t irq = __builtin_ctz(ready);
+            void (*vector)(void) = NVIC_vector(irq);
+            int prio = NVIC_priority(irq);
+
+            if (vector == nullptr) {
+                NVIC_unhandled(irq);
+            } else if (prio < best_prio) {
+                isr = vector;
+                best_prio = prio;
+                best = irq;
+            }
+        }
+        if (isr == nullptr) {
+            return;
+        }
+
+        memory[ADDR_NVIC_IRQ].hw_fetch_and(~(1U << best));
+        memory[ADDR_NVIC_ACTIVE].hw_fetch_or(1U << best);
+        nvic_running_prio.store(best_prio, std::memory_order_relaxed);
+        nvic_in_isr = true;
+        isr();
+        nvic_running_prio.store(running, std::memory_order_relaxed);
+        nvic_in_isr = running < NVIC_PRIO_LEVELS;
+        memory[ADDR_NVIC_ACTIVE].hw_fetch_and(~(1U << best));
+    }
+}
+
+/**
+ * @brief Gets the pending ISRs run and wakes up the tasks sleeping until the IRQs raised
+ *
+ * An ISR that raises an IRQ of a higher priority is preempted at once, any
+ * other task wakes up the dispatcher task. Host threads do not call the
+ * kernel, the event task does both for them.
+ * @param raised enabled IRQs that became pending, 0 if none
+ */
+static void NVIC_notify(uint32_t raised) {
+    if (EventQueue::host_thread()) {
+        events.input(NVIC_input, raised);
+        return;
+    }
+
+    if (raised != 0) {
+        PWR_wake(raised);
+    }
+    if (nvic_in_isr && (xTaskGetCurrentTaskHandle() == nvic_task)) {
+        NVIC_dispatch();
+    } else if (nvic_task != nullptr) {
+        xTaskNotifyGive(nvic_task);
+    }
+}
+
+/**
+ * @brief Host input of NVIC_notify(), runs it on the event task
+ * @param param enabled IRQs that became pending, 0 if none
+ */
+static void NVIC_input(uint32_t param) {
+    NVIC_notify(param);
+}
+
+[[noreturn]] static void NVIC_thread(void *parameters) {
+    (void) parameters;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        NVIC_dispatch();
+    }
+}
+
+uint32_t NVIC_IRQ_cb(uint32_t old_val, uint32_t val, uint32_t param) {
     (void) param;
+    uint32_t raised = val & ~old_val & memory.peek(ADDR_NVIC_CTRL);
 
-    if (memory[ADDR_WDOG_CTRL] & 0x00000001) {
-        xSemaphoreGive(WDT_Enable);
+    if (raised != 0) {
+        NVIC_notify(raised);
     }
 
     return 0;
 }
 
-uint32_t WDT_feed_cb(int val, int param) {
+uint32_t NVIC_CTRL_cb(uint32_t old_val, uint32_t val, uint32_t param) {
+    (void) old_val;
     (void) val;
     (void) param;
-    if (val == 0x00505345) {
-        xSemaphoreGive(WDT_Feed);
+
+    /* Enabling a pending IRQ or raising its priority may let it run */
+    if ((memory.peek(ADDR_NVIC_IRQ) & memory.peek(ADDR_NVIC_CTRL)) != 0) {
+        NVIC_notify(0);
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -55,6 +55,12 @@ extern "C" {
 /** PORT D has IRQ #3 */
 #define NVIC_PORTD_IRQ_NUM 3
 
+/** TIMER overflow has IRQ #8 */
+#define NVIC_TIMER_OVF_IRQ_NUM 8
+
+/** TIMER compare has IRQ #9 */
+#define NVIC_TIMER_CMP_IRQ_NUM 9
+
 /** RTC has IRQ #14 */
 #define NVIC_RTC_IRQ_NUM 14
 
@@ -64,12 +70,127 @@ extern "C" {
 /** UART has irq #23 */
 #define NVIC_UART_IRQ_NUM 23
 
+/** Bus fault has irq #31 */
+#define NVIC_BUSFAULT_IRQ_NUM 31
+
+/** Bits of an IRQ priority, 0 is the highest */
+#define NVIC_PRIO_BITS (4)
+
+/** Number of IRQ priority levels */
+#define NVIC_PRIO_LEVELS (1 << NVIC_PRIO_BITS)
+
+/** IRQ priorities in each NVIC_PRIOx register */
+#define NVIC_PRIO_PER_REG (32 / NVIC_PRIO_BITS)
+
+/** The ISRs run in a task of this priority, they preempt the firmware tasks below it */
+#define NVIC_TASK_PRIORITY (configMAX_PRIORITIES - 2)
+
 /** Shift value to access PRESCALER value on TIMER_CTRL register */
 #define TIMER_CTRL_PRESCALER_SHIFT (8)
 
 /** Shift value to access PRESCALER value on WDOG_CTRL register */
 #define WDT_CTRL_PRESCALER_SHIFT (8)
 
+/** Default SRAM size (256 KB) */
+#define SRAM_DEFAULT_SIZE (256 * 1024)
+
+/** Default Flash size (1 MB) */
+#define FLASH_DEFAULT_SIZE (1024 * 1024)
+
+/**
+ * @brief Configures SRAM and Flash regions, must be called before SoC_Init
+ * @param sram_size SRAM size in bytes, 0 for no SRAM
+ * @param flash_file file with the Flash contents, NULL for no Flash
+ * @param flash_size Flash size in bytes
+ * @param flash_persistent true to write Flash changes back to the file
+ */
+void SoC_MemoryConfig(uint32_t sram_size, const char *flash_file, uint32_t flash_size, bool flash_persistent);
+
+/**
+ * @brief Exports the register file in POSIX shared memory, must be called before SoC_Init
+ *
+ * The segment layout is described in RegShm.h. It is removed at exit.
+ * @param name segment name for shm_open(), e.g. "/socsim", NULL to disable
+ */
+void SoC_ShmConfig(const char *name);
+
+/**
+ * @brief Sets the simulation speed, can be called at any time
+ *
+ * The speed applies to the FreeRTOS tick and so to the firmware delays and
+ * every peripheral (RTC, DAC, watchdog, UART).
+ * @param speed virtual seconds per host second, from 0.01 to 1000, 0 to run as fast as possible
+ * (idle time is skipped)
+ */
+void SoC_SpeedSet(double speed);
+
+/**
+ * @brief Gets the simulation speed
+ * @return virtual seconds per host second, 0 when running as fast as possible
+ */
+double SoC_SpeedGet();
+
+/**
+ * @brief Makes the simulation deterministic, must be called before SoC_Init
+ *
+ * Virtual time only moves while the firmware is idle, by whole ticks, and the
+ * simulation speed only paces it, so firmware code takes no virtual time.
+ * Inputs from the GUI and the UART take effect at the start of the tick after
+ * the simulator takes them. Two runs with the same input file and seed run
+ * the same. Firmware that polls without blocking never lets the time move.
+ * @param seed 0 to run events at the same time in post order, else the seed of their order
+ * @param record_file file to write the inputs to, NULL for none
+ * @param replay_file file to read the inputs from, instead of the GUI and the UART, NULL for none
+ */
+void SoC_DeterministicConfig(uint64_t seed, const char *record_file, const char *replay_file);
+
+/**
+ * @brief Applies the simulator command line options, before SoC_Init
+ *
+ * --speed <factor|max> sets the simulation speed. --deterministic, --seed <n>,
+ * --record <file> and --replay <file> make the simulation deterministic, see
+ * SoC_DeterministicConfig().
+ * @param argc number of arguments
+ * @param argv arguments
+ */
+void SoC_ParseArgs(int argc, char *argv[]);
+
+/**
+ * @brief Idle task hook, see portSUPPRESS_TICKS_AND_SLEEP in FreeRTOSConfig.h
+ *
+ * Stops the tick and sleeps until the next timeout or event, or steps over
+ * the idle time when running as fast as possible or when a task sleeps in
+ * HAL_WFI() or HAL_DeepSleep().
+ * @param expected_idle ticks until the next task timeout
+ */
+void SoC_SuppressTicks(unsigned long expected_idle);
+
+/**
+ * @brief Blocks the calling task until an IRQ is raised, see HAL_WFI() and HAL_DeepSleep()
+ * @param mode POWER_SLEEP to wake up on any IRQ, POWER_DEEP_SLEEP on the IRQs set in PWR_WAKE
+ */
+void SoC_WaitForInterrupt(int mode);
+
+/**
+ * @brief Selects where the register bit coverage report is written at exit
+ * @param file file to write, "-" to print it to stdout, NULL for no report (default)
+ */
+void SoC_CoverageConfig(const char *file);
+
+/**
+ * @brief Backdoor read for tools, no callbacks, counters or watchpoints
+ * @param addr address to access
+ * @return stored value, 0 on unmapped addresses
+ */
+uint32_t SoC_MemoryPeek(uint32_t addr);
+
+/**
+ * @brief Backdoor write for tools, no callbacks, counters or watchpoints
+ * @param addr address to access
+ * @param val value to store
+ */
+void SoC_MemoryPoke(uint32_t addr, uint32_t val);
+
 /**
  * @brief Initializes SoC library
  */
@@ -134,6 +255,29 @@ unsigned int PWMFreqGet();
  */
 unsigned int TimerFreqGet();
 
+/**
+ * @brief Level of the PWM output at a virtual time
+ *
+ * The output is '1' while the counter is at least TIMER_CMP. The result is
+ * exact for any time since the last change of the timer configuration.
+ * @param time virtual time in ns
+ * @return true if the output is '1'
+ */
+bool PWMOutputAt(uint64_t time);
+
+/**
+ * @brief Time of the next edge of the PWM output
+ * @param time virtual time in ns
+ * @return virtual time of the first edge after time in ns, UINT64_MAX if the output does not change
+ */
+uint64_t PWMNextEdge(uint64_t time);
+
+/**
+ * @brief Current RTC counter value for the GUI
+ * @return RTC seconds
+ */
+unsigned int RTCCountGet();
+
 /**
  * DAC buffer size
  */
@@ -160,6 +304,13 @@ void UART_NotifyRxData();
 
 void ADCSetValue(int ch, uint16_t value);
 
+/**
+ * @brief Raises bus fault IRQ and calls BUS_FAULT_ISR in the faulting context
+ * @param addr faulting address
+ * @param write true on write accesses
+ */
+void SoC_BusFaultIRQ(uint32_t addr, bool write);
+
 #ifdef __cplusplus
 }
 #endif
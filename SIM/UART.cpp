@@ -8,7 +8,9 @@
 #include "UART.h"
 #include "Memory.h"
 #include "SoC.h"
+#include "EventQueue.h"
 #include <unistd.h>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
@@ -17,7 +19,31 @@
 
 typedef void * (*THREADFUNCPTR)(void *);
 
-UART::UART(int m_baudrate): baudrate(m_baudrate) {
+/** Bits per frame: start, 8 data bits and stop */
+#define UART_FRAME_BITS (10)
+
+/** Maximum number of UARTs */
+#define UART_MAX (4)
+
+/**
+ * @brief UARTs, the event parameter is the index
+ */
+static UART *uarts[UART_MAX];
+
+/**
+ * @brief Number of UARTs
+ */
+static uint32_t n_uarts = 0;
+
+UART::UART(int m_baudrate): baudrate(m_baudrate), index(n_uarts),
+                            frame_ns(UART_FRAME_BITS * 1000000000ULL / m_baudrate) {
+  
+  /* The events find the UART by index, there is no room for another one */
+  if (n_uarts >= UART_MAX) {
+    printf("Too many UARTs, at most %d\n", UART_MAX);
+    abort();
+  }
+  uarts[n_uarts++] = this;
   
   // taken from https://github.com/cymait/virtual-serial-port-example
   // al credits to him/her
@@ -46,7 +72,7 @@ UART::UART(int m_baudrate): baudrate(m_baudrate) {
   tcsetattr(fd, TCSANOW, &newtio);
 
   pthread_t thread;
-  pthread_create(&thread, nullptr, (THREADFUNCPTR) &UART::reader, &fd);
+  pthread_create(&thread, nullptr, (THREADFUNCPTR) &UART::reader, this);
 }
 
 std::string UART::getDevicename() const{
@@ -57,23 +83,88 @@ int UART::getBaudrate() const {
   return baudrate;
 }
 
-void UART::send(uint8_t data) const {
-    [[maybe_unused]] ssize_t i = write(fd, &data, 1);
+void UART::send(uint8_t data) {
+    bool idle;
+    {
+        EventLock lock;
+
+        idle = tx_buffer.empty();
+        tx_buffer.push(data);
+    }
+
+    if (idle) {
+        events.post_in(frame_ns, txEvent, index);
+    }
 }
 
 
 [[noreturn]] void *UART::reader(void* param) {
-    int fd = *(int*) param;
+    UART *uart = (UART *) param;
 
+    EventQueue::set_host_thread();
     while (true) {
         char inputbyte;
-        if (read(fd, &inputbyte, 1) == 1) {
-            updateRegister(inputbyte);
+        if (read(uart->fd, &inputbyte, 1) == 1) {
+            events.input(rxInput, ((uint32_t) uart->index << 8) | (uint8_t) inputbyte);
         }
     }
 }
 
 void UART::updateRegister(uint8_t val) {
-    memory[ADDR_UART_RXDATA] = val;
+    memory[ADDR_UART_RXDATA].hw_write(val);
     UART_NotifyRxData();
-}
\ No newline at end of file
+}
+
+void UART::rxInput(uint32_t param) {
+    /* A replayed input file may name a UART this run does not have */
+    if ((param >> 8) >= n_uarts) {
+        return;
+    }
+
+    UART *uart = uarts[param >> 8];
+    bool idle = uart->rx_buffer.empty();
+
+    uart->rx_buffer.push((uint8_t) (param & 0xFF));
+
+    /* The byte starts now and is received one frame later, the next ones follow it */
+    if (idle) {
+        events.post_in(uart->frame_ns, rxEvent, param >> 8);
+    }
+}
+
+/**
+ * @brief Delivers the next received byte to the firmware
+ * @param param UART index
+ */
+void UART::rxEvent(uint32_t param) {
+    UART *uart = uarts[param];
+    uint8_t val = uart->rx_buffer.front();
+
+    uart->rx_buffer.pop();
+    updateRegister(val);
+    if (!uart->rx_buffer.empty()) {
+        events.post_in(uart->frame_ns, rxEvent, param);
+    }
+}
+
+/**
+ * @brief Sends the next byte to the terminal
+ * @param param UART index
+ */
+void UART::txEvent(uint32_t param) {
+    UART *uart = uarts[param];
+    uint8_t data;
+    bool more;
+    {
+        EventLock lock;
+
+        data = uart->tx_buffer.front();
+        uart->tx_buffer.pop();
+        more = !uart->tx_buffer.empty();
+    }
+
+    [[maybe_unused]] ssize_t i = write(uart->fd, &data, 1);
+    if (more) {
+        events.post_in(uart->frame_ns, txEvent, param);
+    }
+}
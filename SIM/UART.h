@@ -11,21 +11,42 @@
 #include <string>
 #include <queue>
 
+/**
+ * @brief UART on a pseudo terminal
+ *
+ * Frames are paced in virtual time: received bytes reach UART_RXDATA and
+ * sent bytes reach the terminal one frame time (10 bits) apart, so the
+ * simulation speed applies to the UART too.
+ *
+ * The buffers are only used by the tasks: tx_buffer by the firmware tasks and
+ * the event task, with the scheduler suspended (EventLock), rx_buffer by the
+ * event task alone. The reader thread hands received bytes over as host inputs.
+ */
 class UART {
 public:
     explicit UART(int baudrate);
     std::string getDevicename() const;
     int getBaudrate() const;
-    void send(uint8_t data) const;
+    void send(uint8_t data);
+
+    /**
+     * @brief Host input of a received byte, see EventQueue::input()
+     * @param param UART index << 8 | byte
+     */
+    static void rxInput(uint32_t param);
 private:
     int fd;
     std::string device_name;
     int baudrate;
+    uint32_t index;
+    uint64_t frame_ns;
     std::queue<uint8_t> tx_buffer;
     std::queue<uint8_t> rx_buffer;
 
     [[noreturn]] static void *reader(void*);
     static void updateRegister(uint8_t val);
+    static void rxEvent(uint32_t param);
+    static void txEvent(uint32_t param);
 };
 
 #endif /* SIM_UART_H_ */
@@ -115,7 +115,7 @@ void example_thread(void *parameters) {
     configASSERT(!"CANNOT EXIT FROM A TASK");
 }
 
-int main(void) {
+int main(int argc, char *argv[]) {
     BaseType_t rc;
     const uint16_t stack_depth = 1000;
 
@@ -134,6 +134,9 @@ int main(void) {
 
     printf("Simple test for FreeRTOS Linux port.\n");
 
+    /* Simulator options, e.g. --speed 10 */
+    SoC_ParseArgs(argc, argv);
+
     /* Create GUI */
     gui_create();
     SoC_Init();
@@ -0,0 +1,321 @@
+/*!
+ \file port.c
+ \brief FreeRTOS port that runs every task as a fiber of one host thread
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/times.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+/*
+ * Every task is a ucontext with its own host stack. A switch is a call to
+ * vTaskSwitchContext() and a swapcontext() to the task it selects, done in a
+ * critical section; the task that resumes leaves that critical section. The
+ * first switch into a new task ends in prvFiberStart(), which does the same.
+ *
+ * Only the scheduler thread runs the kernel, so a critical section is just a
+ * nesting count. The SIGALRM handler only counts the tick: the scheduler
+ * thread gives the pending ticks to the kernel at its next switch point, a
+ * yield or the end of a critical section, together with a yield left pending
+ * inside one.
+ */
+
+/** Task context */
+typedef struct {
+    ucontext_t xContext;        /**< saved registers and host stack */
+    void *pvStack;              /**< host stack mapping, with a guard page at the bottom */
+    size_t xStackSize;          /**< size of the mapping */
+    TaskFunction_t pxCode;      /**< task function */
+    void *pvParameters;         /**< task function parameter */
+} Fiber_t;
+
+/* The first member of a TCB is its top of stack, which holds the Fiber_t. */
+typedef void TCB_t;
+extern volatile TCB_t * volatile pxCurrentTCB;
+
+/** Thread that runs the tasks */
+static pthread_t xSchedulerThread;
+
+/** pdTRUE from xPortStartScheduler() to vPortEndScheduler() */
+static volatile BaseType_t xSchedulerStarted = pdFALSE;
+
+/** Context of vTaskStartScheduler(), resumed by vPortEndScheduler() */
+static ucontext_t xSchedulerContext;
+
+/** Critical nesting of the scheduler thread */
+static volatile UBaseType_t uxCriticalNesting = 0;
+
+/** Ticks are masked, set by vTaskStartScheduler() and vTaskEndScheduler() */
+static volatile BaseType_t xInterruptsEnabled = pdFALSE;
+
+/** A task yielded in a critical section */
+static volatile BaseType_t xYieldPending = pdFALSE;
+
+/** Ticks counted by the signal handler and not given to the kernel yet */
+static UBaseType_t uxPendingTicks = 0;
+/*-----------------------------------------------------------*/
+
+static Fiber_t *prvCurrentFiber( void )
+{
+    return *( Fiber_t * const * ) pxCurrentTCB;
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvOnSchedulerThread( void )
+{
+    return ( xSchedulerStarted != pdFALSE ) && pthread_equal( pthread_self(), xSchedulerThread );
+}
+/*-----------------------------------------------------------*/
+
+/* In a critical section. */
+static void prvIncrementTicks( void )
+{
+    UBaseType_t uxTicks;
+
+    while( ( uxTicks = __atomic_exchange_n( &uxPendingTicks, 0, __ATOMIC_ACQUIRE ) ) != 0 )
+    {
+        while( uxTicks-- > 0 )
+        {
+            /* Cooperative, a task woken up by the tick runs at the next yield. */
+            ( void ) xTaskIncrementTick();
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+/* In a critical section. */
+static void prvSwitchTask( void )
+{
+    Fiber_t *pxFrom = prvCurrentFiber();
+    Fiber_t *pxTo;
+
+    vTaskSwitchContext();
+    pxTo = prvCurrentFiber();
+    if( pxTo != pxFrom )
+    {
+        swapcontext( &pxFrom->xContext, &pxTo->xContext );
+    }
+}
+/*-----------------------------------------------------------*/
+
+/* Serves the ticks and the yield left pending, on the scheduler thread out of
+any critical section. */
+static void prvServicePending( void )
+{
+    while( ( uxCriticalNesting == 0 ) && ( xInterruptsEnabled != pdFALSE ) )
+    {
+        if( __atomic_load_n( &uxPendingTicks, __ATOMIC_RELAXED ) != 0 )
+        {
+            uxCriticalNesting++;
+            prvIncrementTicks();
+            uxCriticalNesting--;
+        }
+        else if( xYieldPending != pdFALSE )
+        {
+            xYieldPending = pdFALSE;
+            uxCriticalNesting++;
+            prvSwitchTask();
+            uxCriticalNesting--;
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+/* Any thread may get the timer signal. Only async-signal-safe work here: the
+count is lock-free, the kernel and the tick hook run on the scheduler thread. */
+static void prvTickSignal( int lSignal )
+{
+    ( void ) lSignal;
+    __atomic_add_fetch( &uxPendingTicks, 1, __ATOMIC_RELEASE );
+}
+/*-----------------------------------------------------------*/
+
+static void prvFiberStart( void )
+{
+    Fiber_t *pxFiber = prvCurrentFiber();
+
+    /* Leave the critical section of the switch that started the task. */
+    vPortExitCritical();
+
+    pxFiber->pxCode( pxFiber->pvParameters );
+
+    configASSERT( !"CANNOT EXIT FROM A TASK" );
+    vTaskDelete( NULL );
+}
+/*-----------------------------------------------------------*/
+
+StackType_t *pxPortInitialiseStack( StackType_t *pxTopOfStack, TaskFunction_t pxCode, void *pvParameters )
+{
+    size_t xPage = ( size_t ) sysconf( _SC_PAGESIZE );
+    Fiber_t *pxFiber = malloc( sizeof( Fiber_t ) );
+
+    ( void ) pxTopOfStack;
+
+    configASSERT( pxFiber != NULL );
+    pxFiber->xStackSize = portFIBER_STACK_SIZE + xPage;
+    pxFiber->pvStack = mmap( NULL, pxFiber->xStackSize, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0 );
+    configASSERT( pxFiber->pvStack != MAP_FAILED );
+
+    /* A task that overflows its host stack faults instead of writing over the heap. */
+    mprotect( pxFiber->pvStack, xPage, PROT_NONE );
+
+    pxFiber->pxCode = pxCode;
+    pxFiber->pvParameters = pvParameters;
+    getcontext( &pxFiber->xContext );
+    sigemptyset( &pxFiber->xContext.uc_sigmask );
+    pxFiber->xContext.uc_stack.ss_sp = ( char * ) pxFiber->pvStack + xPage;
+    pxFiber->xContext.uc_stack.ss_size = portFIBER_STACK_SIZE;
+    pxFiber->xContext.uc_link = NULL;
+    makecontext( &pxFiber->xContext, prvFiberStart, 0 );
+
+    return ( StackType_t * ) pxFiber;
+}
+/*-----------------------------------------------------------*/
+
+void vPortCleanUpTCB( void *pxTCB )
+{
+    Fiber_t *pxFiber = *( Fiber_t ** ) pxTCB;
+
+    /* The kernel deletes a task from another one, never from the task itself. */
+    munmap( pxFiber->pvStack, pxFiber->xStackSize );
+    free( pxFiber );
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t xPortStartScheduler( void )
+{
+    struct sigaction xAction = { 0 };
+    struct itimerval xTimer = { 0 };
+
+    xSchedulerThread = pthread_self();
+    xSchedulerStarted = pdTRUE;
+
+    xAction.sa_handler = prvTickSignal;
+    sigemptyset( &xAction.sa_mask );
+    xAction.sa_flags = SA_RESTART;
+    sigaction( SIGALRM, &xAction, NULL );
+
+    xTimer.it_interval.tv_sec = portTICK_RATE_MICROSECONDS / 1000000;
+    xTimer.it_interval.tv_usec = portTICK_RATE_MICROSECONDS % 1000000;
+    xTimer.it_value = xTimer.it_interval;
+    setitimer( ITIMER_REAL, &xTimer, NULL );
+
+    /* The first task starts like a switched one, in a critical section. */
+    uxCriticalNesting = 1;
+    xInterruptsEnabled = pdTRUE;
+    swapcontext( &xSchedulerContext, &prvCurrentFiber()->xContext );
+
+    /* Back from vPortEndScheduler(). */
+    return pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+void vPortEndScheduler( void )
+{
+    struct itimerval xTimer = { 0 };
+
+    configASSERT( prvOnSchedulerThread() );
+    setitimer( ITIMER_REAL, &xTimer, NULL );
+    xInterruptsEnabled = pdFALSE;
+
+    /* Back to the state before xPortStartScheduler(). */
+    uxCriticalNesting = 0;
+    __atomic_store_n( &uxPendingTicks, 0, __ATOMIC_RELAXED );
+    xSchedulerStarted = pdFALSE;
+    swapcontext( &prvCurrentFiber()->xContext, &xSchedulerContext );
+}
+/*-----------------------------------------------------------*/
+
+void vPortYield( void )
+{
+    /* Before the scheduler starts there is nothing to switch to. */
+    if( !prvOnSchedulerThread() )
+    {
+        return;
+    }
+
+    xYieldPending = pdTRUE;
+    prvServicePending();
+}
+/*-----------------------------------------------------------*/
+
+void vPortDisableInterrupts( void )
+{
+    xInterruptsEnabled = pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+void vPortEnableInterrupts( void )
+{
+    xInterruptsEnabled = pdTRUE;
+    if( prvOnSchedulerThread() )
+    {
+        prvServicePending();
+    }
+}
+/*-----------------------------------------------------------*/
+
+/* Host threads never call the kernel, the thread that runs it is the only
+one: the scheduler thread, or the thread that creates the tasks before. */
+void vPortEnterCritical( void )
+{
+    configASSERT( ( xSchedulerStarted == pdFALSE ) || prvOnSchedulerThread() );
+    uxCriticalNesting++;
+}
+/*-----------------------------------------------------------*/
+
+void vPortExitCritical( void )
+{
+    uxCriticalNesting--;
+    if( prvOnSchedulerThread() )
+    {
+        prvServicePending();
+    }
+}
+/*-----------------------------------------------------------*/
+
+UBaseType_t uxPortSetInterruptMask( void )
+{
+    vPortEnterCritical();
+    return 0;
+}
+/*-----------------------------------------------------------*/
+
+void vPortClearInterruptMask( UBaseType_t uxMask )
+{
+    ( void ) uxMask;
+    vPortExitCritical();
+}
+/*-----------------------------------------------------------*/
+
+/* Run time stats use the user time of the process, like the Linux port. */
+void vPortFindTicksPerSecond( void )
+{
+}
+/*-----------------------------------------------------------*/
+
+unsigned long ulPortGetTimerValue( void )
+{
+    struct tms xTimes;
+
+    times( &xTimes );
+    return ( unsigned long ) xTimes.tms_utime;
+}
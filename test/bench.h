@@ -0,0 +1,79 @@
+/*!
+ \file bench.h
+ \brief Micro-benchmark helpers
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TEST_BENCH_H_
+#define TEST_BENCH_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+/** Runs of each measurement, the fastest one is reported */
+#define BENCH_RUNS (5)
+
+/**
+ * @brief Keeps the results of the measured code alive
+ */
+extern volatile uint32_t bench_sink;
+
+/**
+ * @brief Times an operation
+ * @param n_ops operations done by one call of op
+ * @param op code to time
+ * @return ns per operation of the fastest run
+ */
+template<typename F>
+double bench_ns(uint64_t n_ops, F op) {
+    double best = 1e300;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        auto start = std::chrono::steady_clock::now();
+        op();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count() / n_ops);
+    }
+    return best;
+}
+
+/**
+ * @brief Times an operation that needs a fresh state on each run
+ * @param n_ops operations done by one call of op
+ * @param setup prepares the state, not timed
+ * @param op code to time
+ * @return ns per operation of the fastest run
+ */
+template<typename S, typename F>
+double bench_ns(uint64_t n_ops, S setup, F op) {
+    double best = 1e300;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        op();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count() / n_ops);
+    }
+    return best;
+}
+
+/**
+ * @brief HAL_MemoryRead/HAL_MemoryWrite throughput, against the hash map decode the register file replaced
+ */
+void bench_decode();
+
+/**
+ * @brief Register access cost with no watchpoints, a watchpoint on another page and one on the same page
+ */
+void bench_watch();
+
+/**
+ * @brief Event queue with 10k pending events, against the binary heap the timing wheel replaced
+ */
+void bench_events();
+
+#endif /* TEST_BENCH_H_ */
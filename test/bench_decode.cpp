@@ -0,0 +1,77 @@
+/*!
+ \file bench_decode.cpp
+ \brief Register decode benchmark: page table of register blocks against the former hash map
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <cstdio>
+#include <functional>
+#include <unordered_map>
+
+#include "Memory.h"
+#include "bench.h"
+
+/** Accesses per run */
+#define DECODE_OPS (20000000)
+
+/**
+ * @brief Register of the former memory map: a value and two std::function hooks in a hash map
+ */
+struct HashWord {
+    uint32_t data = 0;
+    std::function<uint32_t(uint32_t, uint32_t)> cb_rd;
+    std::function<uint32_t(uint32_t, uint32_t)> cb_wr;
+};
+
+/** Registers without callbacks, so only the decode is measured */
+static const uint32_t decode_addrs[8] = {
+    ADDR_PORTA_CTRL, ADDR_PORTA_OUT, ADDR_PORTB_CTRL, ADDR_PORTB_OUT,
+    ADDR_PORTC_OUT, ADDR_PORTD_OUT, ADDR_DAC_CTRL, ADDR_DAC_DATA,
+};
+
+void bench_decode() {
+    std::unordered_map<uint32_t, HashWord> hash_map;
+
+    for (const auto &reg : reg_table) {
+        hash_map[reg.addr];
+    }
+
+    /* The addresses go through a volatile so the decode is not folded at compile time */
+    double hash_wr = bench_ns(DECODE_OPS, [&hash_map] {
+        for (uint32_t i = 0; i < DECODE_OPS; i++) {
+            HashWord &word = hash_map[decode_addrs[bench_sink & 7]];
+            word.data = i;
+            if (word.cb_wr) {
+                word.cb_wr(i, 0);
+            }
+            bench_sink = bench_sink + 1;
+        }
+    });
+    double hash_rd = bench_ns(DECODE_OPS, [&hash_map] {
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < DECODE_OPS; i++) {
+            HashWord &word = hash_map[decode_addrs[i & 7]];
+            sum += word.cb_rd ? word.cb_rd(word.data, 0) : word.data;
+        }
+        bench_sink = sum;
+    });
+    double map_wr = bench_ns(DECODE_OPS, [] {
+        for (uint32_t i = 0; i < DECODE_OPS; i++) {
+            memory.write(decode_addrs[bench_sink & 7], i);
+            bench_sink = bench_sink + 1;
+        }
+    });
+    double map_rd = bench_ns(DECODE_OPS, [] {
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < DECODE_OPS; i++) {
+            sum += memory.read(decode_addrs[i & 7]);
+        }
+        bench_sink = sum;
+    });
+
+    printf("%-34s %8s %8s\n", "", "write", "read");
+    printf("%-34s %5.1f ns %5.1f ns\n", "hash map (before)", hash_wr, hash_rd);
+    printf("%-34s %5.1f ns %5.1f ns\n", "page table (HAL_MemoryWrite/Read)", map_wr, map_rd);
+}
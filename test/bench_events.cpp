@@ -0,0 +1,168 @@
+/*!
+ \file bench_events.cpp
+ \brief Event queue benchmark: timing wheel against the former binary heap, with 10k pending events
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "EventQueue.h"
+#include "bench.h"
+#include "fake_kernel.h"
+
+/** Pending events */
+#define EVENTS_PENDING (10000)
+
+/** Cancel and repost operations per run on the former heap, its cancel is linear */
+#define EVENTS_HEAP_CANCELS (1000)
+
+/** Events spread over this many ticks from now, 10 s */
+#define EVENTS_SPAN_TICKS (10000)
+
+/**
+ * @brief Event of the former queue: a binary heap searched on cancel
+ */
+struct HeapEvent {
+    uint64_t when;
+    uint64_t seq;
+    event_func cb;
+    uint32_t param;
+    int id;
+
+    bool operator<(const HeapEvent &other) const {
+        return (when != other.when) ? (when > other.when) : (seq > other.seq);
+    }
+};
+
+/**
+ * @brief The former event queue, without its locking
+ */
+class HeapQueue {
+public:
+    int post_at(uint64_t when, event_func cb, uint32_t param) {
+        heap.push_back({when, next_seq++, cb, param, next_id});
+        std::push_heap(heap.begin(), heap.end());
+        return next_id++;
+    }
+
+    bool cancel(int id) {
+        auto it = std::find_if(heap.begin(), heap.end(), [id](const HeapEvent &e) { return e.id == id; });
+
+        if (it == heap.end()) {
+            return false;
+        }
+        heap.erase(it);
+        std::make_heap(heap.begin(), heap.end());
+        return true;
+    }
+
+    void run_due(uint64_t time) {
+        while (!heap.empty() && (heap.front().when <= time)) {
+            std::pop_heap(heap.begin(), heap.end());
+            HeapEvent e = heap.back();
+            heap.pop_back();
+            e.cb(e.param);
+        }
+    }
+
+private:
+    std::vector<HeapEvent> heap;
+    uint64_t next_seq = 0;
+    int next_id = 0;
+};
+
+/**
+ * @brief Event handler, keeps its parameter
+ */
+static void bench_event(uint32_t param) {
+    bench_sink = bench_sink + param;
+}
+
+/* Deterministic mode reads the virtual time from the tick count alone */
+
+static void bench_prepare(HeapQueue &) {
+}
+
+static void bench_prepare(EventQueue &queue) {
+    queue.set_deterministic(0, nullptr, nullptr);
+}
+
+static void bench_run(HeapQueue &queue) {
+    queue.run_due((uint64_t) fake_tick * EVENT_NS_PER_TICK);
+}
+
+static void bench_run(EventQueue &queue) {
+    queue.run_due();
+}
+
+/**
+ * @brief Times of the events, spread with a fixed sequence
+ * @param span_ticks ticks covered
+ */
+static std::vector<uint64_t> bench_times(uint64_t span_ticks) {
+    std::vector<uint64_t> times(EVENTS_PENDING);
+    uint64_t x = 12345;
+
+    for (auto &when : times) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        when = (x >> 33) % (span_ticks * EVENT_NS_PER_TICK);
+    }
+    return times;
+}
+
+/**
+ * @brief Measures post, cancel and repost, and run on a queue
+ * @param label row label
+ * @param cancels cancel and repost operations per run
+ * @param span_ticks ticks covered by the events, 0 to put them all in the current tick
+ */
+template<typename Q>
+static void bench_queue(const char *label, int cancels, uint64_t span_ticks) {
+    std::vector<uint64_t> times = bench_times(std::max<uint64_t>(span_ticks, 1));
+    std::unique_ptr<Q> queue;
+    std::vector<int> ids(EVENTS_PENDING);
+    auto fresh = [&queue] {
+        fake_tick = 0;
+        queue.reset(new Q());
+        bench_prepare(*queue);
+    };
+    auto fill = [&] {
+        fresh();
+        for (int i = 0; i < EVENTS_PENDING; i++) {
+            ids[i] = queue->post_at(times[i], bench_event, i);
+        }
+    };
+
+    double post = bench_ns(EVENTS_PENDING, fresh, [&] {
+        for (int i = 0; i < EVENTS_PENDING; i++) {
+            ids[i] = queue->post_at(times[i], bench_event, i);
+        }
+    });
+    double repost = bench_ns(cancels, fill, [&] {
+        for (int i = 0; i < cancels; i++) {
+            int n = (i * 7919) % EVENTS_PENDING;
+
+            queue->cancel(ids[n]);
+            ids[n] = queue->post_at(times[(n + 1) % EVENTS_PENDING], bench_event, n);
+        }
+    });
+    double run = bench_ns(EVENTS_PENDING, fill, [&] {
+        fake_tick = (TickType_t) (span_ticks + 1);
+        bench_run(*queue);
+    });
+
+    printf("%-30s %7.1f ns %9.1f ns %7.1f ns\n", label, post, repost, run);
+}
+
+void bench_events() {
+    printf("%-30s %10s %12s %10s\n", "", "post", "cancel+post", "run");
+    bench_queue<HeapQueue>("binary heap (before)", EVENTS_HEAP_CANCELS, EVENTS_SPAN_TICKS);
+    bench_queue<EventQueue>("timing wheel", EVENTS_PENDING, EVENTS_SPAN_TICKS);
+    bench_queue<HeapQueue>("binary heap, same tick", EVENTS_HEAP_CANCELS, 0);
+    bench_queue<EventQueue>("timing wheel, same tick", EVENTS_PENDING, 0);
+}
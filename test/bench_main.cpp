@@ -0,0 +1,41 @@
+/*!
+ \file bench_main.cpp
+ \brief Runs the micro-benchmarks, all of them or the ones named on the command line
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <cstdio>
+#include <cstring>
+
+#include "bench.h"
+
+volatile uint32_t bench_sink;
+
+/**
+ * @brief Benchmark table
+ */
+static const struct {
+    const char *name;
+    void (*run)();
+} benchmarks[] = {
+    {"decode", bench_decode},
+    {"watch", bench_watch},
+    {"events", bench_events},
+};
+
+int main(int argc, char *argv[]) {
+    for (const auto &bench : benchmarks) {
+        bool selected = (argc < 2);
+
+        for (int i = 1; i < argc; i++) {
+            selected |= (strcmp(argv[i], bench.name) == 0);
+        }
+        if (selected) {
+            printf("== %s\n", bench.name);
+            bench.run();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*!
+ \file bench_switch.cpp
+ \brief Context switch benchmark: fiber port against the thread per task scheme of the Linux port
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+
+#include "bench.h"
+#include "task.h"
+
+/** Switches per run */
+#define SWITCH_OPS (200000)
+
+volatile uint32_t bench_sink;
+
+/** Yields left in the current run of the fiber tasks */
+static volatile int yields_left;
+
+/**
+ * @brief Fiber task, yields to the other one until the run is done
+ */
+static void switch_task(void *) {
+    while (yields_left > 0) {
+        yields_left = yields_left - 1;
+        taskYIELD();
+    }
+    vTaskEndScheduler();
+}
+
+/**
+ * @brief Two fiber tasks yielding to each other on the fiber port
+ */
+static double switch_fiber() {
+    return bench_ns(SWITCH_OPS, [] {
+        yields_left = SWITCH_OPS;
+        xTaskCreate(switch_task, "A", 1000, nullptr, 1, nullptr);
+        xTaskCreate(switch_task, "B", 1000, nullptr, 1, nullptr);
+    }, [] {
+        vTaskStartScheduler();
+    });
+}
+
+/**
+ * @brief Two threads resuming each other with a signal, as the Linux port switches its task threads
+ */
+static double switch_signal() {
+    sigset_t set;
+    sigset_t old_set;
+
+    /* The signal stays blocked and is taken with sigwait() */
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, &old_set);
+
+    double ns = bench_ns(SWITCH_OPS, [] {}, [&set] {
+        pthread_t main_thread = pthread_self();
+        std::thread other([&set, main_thread] {
+            int sig;
+
+            for (int i = 0; i < SWITCH_OPS / 2; i++) {
+                sigwait(&set, &sig);
+                pthread_kill(main_thread, SIGUSR1);
+            }
+        });
+        int sig;
+
+        for (int i = 0; i < SWITCH_OPS / 2; i++) {
+            pthread_kill(other.native_handle(), SIGUSR1);
+            sigwait(&set, &sig);
+        }
+        other.join();
+    });
+    pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+    return ns;
+}
+
+/**
+ * @brief Two threads handing a turn over with a condition variable
+ */
+static double switch_condvar() {
+    return bench_ns(SWITCH_OPS, [] {}, [] {
+        std::mutex mutex;
+        std::condition_variable turn_changed;
+        int turn = 0;
+        auto play = [&](int me) {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            for (int i = 0; i < SWITCH_OPS / 2; i++) {
+                turn_changed.wait(lock, [&turn, me] { return turn == me; });
+                turn = 1 - me;
+                turn_changed.notify_one();
+            }
+        };
+        std::thread other(play, 1);
+
+        play(0);
+        other.join();
+    });
+}
+
+int main() {
+    cpu_set_t cpus;
+
+    /* The simulator runs its task threads anywhere, one CPU shows the switch cost alone */
+    CPU_ZERO(&cpus);
+    CPU_SET(sched_getcpu(), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    printf("== switch\n");
+    printf("%-34s %5.0f ns\n", "fiber port, taskYIELD()", switch_fiber());
+    printf("%-34s %5.0f ns\n", "threads, sigwait/pthread_kill", switch_signal());
+    printf("%-34s %5.0f ns\n", "threads, condition variable", switch_condvar());
+    return 0;
+}
@@ -0,0 +1,62 @@
+/*!
+ \file bench_watch.cpp
+ \brief Watchpoint benchmark: cost of the page watch flag on unwatched accesses
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <cstdio>
+
+#include "Memory.h"
+#include "bench.h"
+
+/** Accesses per run */
+#define WATCH_OPS (20000000)
+
+/** GPIO registers, on the page of PORTA */
+static const uint32_t watch_addrs[8] = {
+    ADDR_PORTA_CTRL, ADDR_PORTA_OUT, ADDR_PORTB_CTRL, ADDR_PORTB_OUT,
+    ADDR_PORTC_CTRL, ADDR_PORTC_OUT, ADDR_PORTD_CTRL, ADDR_PORTD_OUT,
+};
+
+/**
+ * @brief Times HAL_MemoryWrite/Read and a constant-address |= on the GPIO registers
+ * @param label row label
+ */
+static void bench_watch_row(const char *label) {
+    double wr = bench_ns(WATCH_OPS, [] {
+        for (uint32_t i = 0; i < WATCH_OPS; i++) {
+            memory.write(watch_addrs[bench_sink & 7], i);
+            bench_sink = bench_sink + 1;
+        }
+    });
+    double rd = bench_ns(WATCH_OPS, [] {
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < WATCH_OPS; i++) {
+            sum += memory.read(watch_addrs[i & 7]);
+        }
+        bench_sink = sum;
+    });
+    double rmw = bench_ns(WATCH_OPS, [] {
+        for (uint32_t i = 0; i < WATCH_OPS; i++) {
+            memory[ADDR_PORTA_OUT] |= 4;
+        }
+    });
+
+    printf("%-34s %5.1f ns %5.1f ns %5.1f ns\n", label, wr, rd, rmw);
+}
+
+void bench_watch() {
+    printf("%-34s %8s %8s %8s\n", "", "write", "read", "|=");
+    bench_watch_row("no watchpoints");
+
+    int other = memory.add_watch(ADDR_WDOG_CTRL, ADDR_WDOG_CTRL, 0xFFFFFFFF, true, true, WatchAction::Count);
+    bench_watch_row("watch on WDOG_CTRL (other page)");
+
+    int same = memory.add_watch(ADDR_PORTD_IN, ADDR_PORTD_IN, 0xFFFFFFFF, true, true, WatchAction::Count);
+    bench_watch_row("watch on PORTD_IN (same page)");
+
+    memory.remove_watch(same);
+    memory.remove_watch(other);
+}
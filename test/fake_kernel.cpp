@@ -0,0 +1,75 @@
+/*!
+ \file fake_kernel.cpp
+ \brief Single threaded FreeRTOS kernel with a tick count set by the test, for the event queue tests and benchmarks
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "task.h"
+#include "fake_kernel.h"
+
+TickType_t fake_tick;
+
+/* Tasks are not created, the test calls EventQueue::run_due() itself */
+
+BaseType_t xTaskCreate(TaskFunction_t, const char *, uint32_t, void *, UBaseType_t, TaskHandle_t *created_task) {
+    if (created_task != nullptr) {
+        *created_task = nullptr;
+    }
+    return pdPASS;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return fake_tick;
+}
+
+BaseType_t xTaskIncrementTick(void) {
+    fake_tick++;
+    return pdFALSE;
+}
+
+void vTaskStepTick(TickType_t ticks) {
+    fake_tick += ticks;
+}
+
+/* There is a single thread, so nothing to exclude or to switch to */
+
+void vPortEnterCritical(void) {
+}
+
+void vPortExitCritical(void) {
+}
+
+void vPortYield(void) {
+}
+
+BaseType_t xTaskGetSchedulerState(void) {
+    return taskSCHEDULER_RUNNING;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return nullptr;
+}
+
+void vTaskSuspendAll(void) {
+}
+
+BaseType_t xTaskResumeAll(void) {
+    return pdFALSE;
+}
+
+eSleepModeStatus eTaskConfirmSleepModeStatus(void) {
+    return eStandardSleep;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t) {
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t *) {
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) {
+    return 0;
+}
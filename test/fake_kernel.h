@@ -0,0 +1,19 @@
+/*!
+ \file fake_kernel.h
+ \brief Single threaded FreeRTOS kernel with a tick count set by the test, for the event queue tests and benchmarks
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TEST_FAKE_KERNEL_H_
+#define TEST_FAKE_KERNEL_H_
+
+#include "FreeRTOS.h"
+
+/**
+ * @brief Tick count returned by xTaskGetTickCount(), no task runs and no timer moves it
+ */
+extern TickType_t fake_tick;
+
+#endif /* TEST_FAKE_KERNEL_H_ */
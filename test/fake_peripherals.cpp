@@ -0,0 +1,91 @@
+/*!
+ \file fake_peripherals.cpp
+ \brief Register callbacks of the peripheral models replaced by call counters, for the tests and benchmarks
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "Memory.h"
+#include "fake_peripherals.h"
+
+FakeHook GPIO_in_hook;
+FakeHook RTC_rd_hook;
+FakeHook RTC_set_hook;
+FakeHook TIMER_hook;
+
+/**
+ * @brief Counts a write callback call
+ */
+static uint32_t fake_write(FakeHook &hook, uint32_t old_val, uint32_t val) {
+    hook.old_val.store(old_val, std::memory_order_relaxed);
+    hook.new_val.store(val, std::memory_order_relaxed);
+    hook.calls.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
+
+/**
+ * @brief Counts a read callback call, the register reads its stored value
+ */
+static uint32_t fake_read(FakeHook &hook, uint32_t val) {
+    hook.calls.fetch_add(1, std::memory_order_relaxed);
+    return val;
+}
+
+uint32_t GPIO_in_cb(uint32_t old_val, uint32_t val, uint32_t) {
+    return fake_write(GPIO_in_hook, old_val, val);
+}
+
+uint32_t RTC_rd_cb(uint32_t val, uint32_t) {
+    return fake_read(RTC_rd_hook, val);
+}
+
+uint32_t RTC_set_cb(uint32_t old_val, uint32_t val, uint32_t) {
+    return fake_write(RTC_set_hook, old_val, val);
+}
+
+uint32_t TIMER_cb(uint32_t old_val, uint32_t val, uint32_t) {
+    return fake_write(TIMER_hook, old_val, val);
+}
+
+/* The other models do nothing */
+
+uint32_t NVIC_IRQ_cb(uint32_t, uint32_t, uint32_t) {
+    return 0;
+}
+
+uint32_t NVIC_CTRL_cb(uint32_t, uint32_t, uint32_t) {
+    return 0;
+}
+
+uint32_t Trace_cb(uint32_t, uint32_t, uint32_t) {
+    return 0;
+}
+
+uint32_t send_to_uart(uint32_t, uint32_t, uint32_t) {
+    return 0;
+}
+
+uint32_t ADC_data_cb(uint32_t val, uint32_t) {
+    return val;
+}
+
+uint32_t TIMER_rd_cb(uint32_t val, uint32_t) {
+    return val;
+}
+
+uint32_t RTC_cb(uint32_t, uint32_t, uint32_t) {
+    return 0;
+}
+
+uint32_t WDT_cb(uint32_t, uint32_t, uint32_t) {
+    return 0;
+}
+
+uint32_t WDT_feed_cb(uint32_t, uint32_t, uint32_t) {
+    return 0;
+}
+
+uint32_t PWR_rd_cb(uint32_t val, uint32_t) {
+    return val;
+}
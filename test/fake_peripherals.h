@@ -0,0 +1,38 @@
+/*!
+ \file fake_peripherals.h
+ \brief Register callbacks of the peripheral models replaced by call counters, for the tests and benchmarks
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TEST_FAKE_PERIPHERALS_H_
+#define TEST_FAKE_PERIPHERALS_H_
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * @brief Calls made to a fake register callback
+ */
+struct FakeHook {
+    std::atomic<uint64_t> calls{0};     /**< number of calls */
+    std::atomic<uint32_t> old_val{0};   /**< old value of the last write */
+    std::atomic<uint32_t> new_val{0};   /**< new value of the last write */
+
+    /**
+     * @brief Clears the counters
+     */
+    void clear() {
+        calls = 0;
+        old_val = 0;
+        new_val = 0;
+    }
+};
+
+extern FakeHook GPIO_in_hook;
+extern FakeHook RTC_rd_hook;
+extern FakeHook RTC_set_hook;
+extern FakeHook TIMER_hook;
+
+#endif /* TEST_FAKE_PERIPHERALS_H_ */
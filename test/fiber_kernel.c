@@ -0,0 +1,81 @@
+/*!
+ \file fiber_kernel.c
+ \brief Round-robin kernel for the fiber port, so its context switch can be timed without the FreeRTOS sources
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "task.h"
+
+/** Tasks of the benchmark */
+#define FIBER_TASKS (2)
+
+/**
+ * @brief Task control block, the port keeps its fiber in the first member like in a FreeRTOS TCB
+ */
+typedef struct {
+    StackType_t *pxTopOfStack;
+} FiberTCB_t;
+
+static FiberTCB_t xTasks[FIBER_TASKS];
+static int n_tasks;
+static int cur_task;
+static TickType_t tick_count;
+
+volatile void *volatile pxCurrentTCB;
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task) {
+    (void) name;
+    (void) stack_depth;
+    (void) priority;
+
+    /* The fibers of a previous run are not freed, they never resume */
+    if (n_tasks == FIBER_TASKS) {
+        n_tasks = 0;
+    }
+    xTasks[n_tasks].pxTopOfStack = pxPortInitialiseStack(NULL, code, parameters);
+    if (created_task != NULL) {
+        *created_task = &xTasks[n_tasks];
+    }
+    n_tasks++;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    (void) task;
+    abort();
+}
+
+void vTaskStartScheduler(void) {
+    cur_task = 0;
+    pxCurrentTCB = &xTasks[0];
+    (void) xPortStartScheduler();
+}
+
+void vTaskEndScheduler(void) {
+    vPortEndScheduler();
+}
+
+void vTaskSwitchContext(void) {
+    cur_task = (cur_task + 1) % n_tasks;
+    pxCurrentTCB = &xTasks[cur_task];
+}
+
+BaseType_t xTaskIncrementTick(void) {
+    tick_count++;
+    return pdFALSE;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return tick_count;
+}
+
+void vAssertCalled(unsigned long ulLine, const char *const pcFileName) {
+    printf("Assert failed at %s:%lu\n", pcFileName, ulLine);
+    abort();
+}
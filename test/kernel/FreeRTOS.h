@@ -0,0 +1,44 @@
+/*!
+ \file FreeRTOS.h
+ \brief Subset of the FreeRTOS kernel API used by the event queue and the fiber port, for the tests and benchmarks
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TEST_KERNEL_FREERTOS_H_
+#define TEST_KERNEL_FREERTOS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "FreeRTOSConfig.h"
+
+/* The port types and the critical section macros come from the fiber port */
+#include "portmacro.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE (1)
+#define pdFALSE (0)
+#define pdPASS (1)
+
+#define taskENTER_CRITICAL() portENTER_CRITICAL()
+#define taskEXIT_CRITICAL() portEXIT_CRITICAL()
+#define taskYIELD() portYIELD()
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Port layer, called by the kernel */
+StackType_t *pxPortInitialiseStack(StackType_t *pxTopOfStack, TaskFunction_t pxCode, void *pvParameters);
+BaseType_t xPortStartScheduler(void);
+void vPortEndScheduler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEST_KERNEL_FREERTOS_H_ */
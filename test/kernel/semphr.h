@@ -0,0 +1,17 @@
+/*!
+ \file semphr.h
+ \brief Semaphore API header, included by HAL.h and SoC.h, for the tests and benchmarks
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TEST_KERNEL_SEMPHR_H_
+#define TEST_KERNEL_SEMPHR_H_
+
+#include "FreeRTOS.h"
+
+/* Nothing in the tested code uses semaphores, the header only has to exist */
+typedef void *SemaphoreHandle_t;
+
+#endif /* TEST_KERNEL_SEMPHR_H_ */
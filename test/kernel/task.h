@@ -0,0 +1,50 @@
+/*!
+ \file task.h
+ \brief Subset of the FreeRTOS task API used by the event queue and the fiber port, for the tests and benchmarks
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TEST_KERNEL_TASK_H_
+#define TEST_KERNEL_TASK_H_
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    eAbortSleep = 0,
+    eStandardSleep,
+    eNoTasksWaitingTimeout
+} eSleepModeStatus;
+
+#define taskSCHEDULER_SUSPENDED (0)
+#define taskSCHEDULER_NOT_STARTED (1)
+#define taskSCHEDULER_RUNNING (2)
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task);
+void vTaskDelete(TaskHandle_t task);
+void vTaskStartScheduler(void);
+void vTaskEndScheduler(void);
+void vTaskSwitchContext(void);
+TickType_t xTaskGetTickCount(void);
+BaseType_t xTaskIncrementTick(void);
+void vTaskStepTick(TickType_t ticks);
+BaseType_t xTaskGetSchedulerState(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+void vTaskSuspendAll(void);
+BaseType_t xTaskResumeAll(void);
+eSleepModeStatus eTaskConfirmSleepModeStatus(void);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEST_KERNEL_TASK_H_ */
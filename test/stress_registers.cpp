@@ -0,0 +1,119 @@
+/*!
+ \file stress_registers.cpp
+ \brief Concurrent register access stress test, built with ThreadSanitizer
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <thread>
+#include <vector>
+
+#include "Memory.h"
+#include "fake_peripherals.h"
+#include "test.h"
+
+/** Iterations of each thread */
+#define STRESS_LOOPS (200000)
+
+/** Firmware task threads */
+#define STRESS_TASKS (4)
+
+/** Unmapped and unaligned addresses, they raise bus faults */
+#define STRESS_UNMAPPED (0x05000)
+#define STRESS_UNALIGNED (ADDR_PORTA_OUT + 2)
+
+/** RAM region hammered with the block accesses */
+#define STRESS_RAM_BASE (ADDR_SRAM_BASE)
+#define STRESS_RAM_WORDS (64)
+
+static std::atomic<uint64_t> faults_seen(0);
+
+/**
+ * @brief Bus fault IRQ, counts the faults instead of printing them
+ */
+static void stress_fault(uint32_t, bool) {
+    faults_seen.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Firmware task: plain, read-modify-write, unmapped and RAM accesses
+ * @param id task number, owns bit id of the registers it toggles
+ */
+static void stress_task(uint32_t id) {
+    uint32_t bit = 1U << id;
+    uint32_t block[8];
+
+    for (uint32_t i = 0; i < STRESS_LOOPS; i++) {
+        /* An odd number of toggles per task leaves every owned bit set if no toggle is lost */
+        memory[ADDR_PORTA_OUT] ^= bit;
+        memory[ADDR_TIMER_CTRL] |= bit;
+        memory[ADDR_TIMER_CTRL] &= ~bit;
+        memory[ADDR_PORTB_OUT] = i;
+        (void) (uint32_t) memory[ADDR_RTC_CNT];
+        (void) (uint32_t) memory[ADDR_NVIC_IRQ];
+        memory.write(STRESS_RAM_BASE + (i % STRESS_RAM_WORDS) * 4, i);
+        memory.read_block(STRESS_RAM_BASE, block, 8);
+        if ((i % 64) == 0) {
+            memory.write(STRESS_UNMAPPED, i);
+            (void) memory.read(STRESS_UNALIGNED);
+        }
+    }
+    memory[ADDR_PORTA_OUT] ^= bit;
+}
+
+/**
+ * @brief Peripheral models: raise and clear IRQs and inputs from the hardware side
+ */
+static void stress_peripherals() {
+    for (uint32_t i = 0; i < STRESS_LOOPS; i++) {
+        memory[ADDR_NVIC_IRQ].hw_fetch_or(1U << (i % 32));
+        memory[ADDR_PORTA_IN].hw_write(i);
+        memory[ADDR_NVIC_IRQ].hw_fetch_and(~(1U << (i % 32)));
+        memory[ADDR_UART_RXDATA].hw_write(i & 0xFF);
+    }
+}
+
+/**
+ * @brief GUI: backdoor accesses, watchpoints and change subscriptions set up while the others run
+ */
+static void stress_gui() {
+    RegQueue queue;
+    RegChange change;
+
+    for (uint32_t i = 0; i < STRESS_LOOPS / 100; i++) {
+        int sub = memory.subscribe(ADDR_PORTA_CTRL, ADDR_PORTD_IN, 0xFFFFFFFF, &queue);
+        int watch = memory.add_watch(ADDR_TIMER_CTRL, ADDR_TIMER_CMP, 0xFFFFFFFF, true, true, WatchAction::Count);
+
+        for (int j = 0; j < 100; j++) {
+            (void) memory.peek(ADDR_PORTA_OUT);
+            memory.poke(ADDR_DAC_DATA, j);
+            while (queue.pop(change)) {
+            }
+        }
+        memory.remove_watch(watch);
+        memory.unsubscribe(sub);
+    }
+}
+
+int main() {
+    std::vector<std::thread> threads;
+
+    memory.set_bus_fault(BusFault::Irq, stress_fault);
+    CHECK(memory.add_ram(STRESS_RAM_BASE, STRESS_RAM_WORDS * 4));
+
+    for (uint32_t id = 0; id < STRESS_TASKS; id++) {
+        threads.emplace_back(stress_task, id);
+    }
+    threads.emplace_back(stress_peripherals);
+    threads.emplace_back(stress_gui);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    CHECK_EQ(memory.peek(ADDR_PORTA_OUT), (1U << STRESS_TASKS) - 1);
+    CHECK_EQ(memory.peek(ADDR_TIMER_CTRL), 0);
+    CHECK_EQ(faults_seen.load(), STRESS_TASKS * 2 * ((STRESS_LOOPS + 63) / 64));
+    printf("%d tasks, %d loops: no lost updates\n", STRESS_TASKS, STRESS_LOOPS);
+    return 0;
+}
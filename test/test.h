@@ -0,0 +1,39 @@
+/*!
+ \file test.h
+ \brief Assertions of the tests, they also hold in release builds
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TEST_TEST_H_
+#define TEST_TEST_H_
+
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ * @brief Stops the test with an error if a condition does not hold
+ */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+/**
+ * @brief Stops the test with an error if two integers differ
+ */
+#define CHECK_EQ(a, b) \
+    do { \
+        unsigned long long check_a = (a), check_b = (b); \
+        if (check_a != check_b) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s == %s (%llu != %llu)\n", __FILE__, __LINE__, #a, #b, \
+                    check_a, check_b); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#endif /* TEST_TEST_H_ */
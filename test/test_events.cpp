@@ -0,0 +1,83 @@
+/*!
+ \file test_events.cpp
+ \brief Event queue order and cancel, in the wheel and in the ready heap
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <algorithm>
+#include <vector>
+
+#include "EventQueue.h"
+#include "fake_kernel.h"
+#include "test.h"
+
+/** Events posted */
+#define EVENTS_POSTED (3000)
+
+static std::vector<uint32_t> ran;
+static uint64_t last_when;
+
+/** Time of each event, by parameter */
+static std::vector<uint64_t> when_of(EVENTS_POSTED);
+
+/**
+ * @brief Records the events in the order they run
+ */
+static void test_event(uint32_t param) {
+    CHECK(when_of[param] >= last_when);
+    CHECK(when_of[param] <= (uint64_t) fake_tick * EVENT_NS_PER_TICK);
+    last_when = when_of[param];
+    ran.push_back(param);
+}
+
+int main() {
+    EventQueue queue;
+    std::vector<int> ids(EVENTS_POSTED);
+    uint64_t x = 1;
+
+    queue.set_deterministic(0, nullptr, nullptr);
+
+    /* A third in the current tick, in the ready heap, the rest up to about 3 days ahead */
+    for (uint32_t i = 0; i < EVENTS_POSTED; i++) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        when_of[i] = (i % 3 == 0) ? (x >> 33) % EVENT_NS_PER_TICK : ((x >> 20) % (1ULL << (i % 56 + 1))) << 4;
+        ids[i] = queue.post_at(when_of[i], test_event, i);
+    }
+
+    /* Cancel every fourth event, wherever it is, the second cancel and bogus ids fail */
+    for (uint32_t i = 0; i < EVENTS_POSTED; i += 4) {
+        CHECK(queue.cancel(ids[i]));
+        CHECK(!queue.cancel(ids[i]));
+    }
+    CHECK(!queue.cancel(-1));
+    CHECK(!queue.cancel(1 << 30));
+
+    /* The next event is a pending one, cancelled events on top of the ready heap are dropped */
+    uint64_t first = EVENT_NEVER;
+    for (uint32_t i = 0; i < EVENTS_POSTED; i++) {
+        if (i % 4 != 0) {
+            first = std::min(first, when_of[i]);
+        }
+    }
+    CHECK_EQ(queue.next(), first);
+
+    /* Run in steps of growing length until the end */
+    for (uint64_t step = 1; queue.next() != EVENT_NEVER; step *= 2) {
+        fake_tick += (TickType_t) step;
+        queue.run_due();
+    }
+
+    CHECK_EQ(ran.size(), EVENTS_POSTED - (EVENTS_POSTED + 3) / 4);
+    for (uint32_t param : ran) {
+        CHECK(param % 4 != 0);
+    }
+
+    /* Ids of freed nodes are stale once the node is reused */
+    int id = queue.post_at(0, test_event, 1);
+    CHECK(!queue.cancel(ids[1]));
+    CHECK(queue.cancel(id));
+    printf("%zu events ran in order, %d cancelled\n", ran.size(), (EVENTS_POSTED + 3) / 4);
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*!
+ \file test_rmw.cpp
+ \brief Register read-modify-write calls the write callback once and no read callback
+ \author agent
+ \date Oct 2026
+ */
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "Memory.h"
+#include "HAL.h"
+#include "fake_peripherals.h"
+#include "test.h"
+
+/** Operations of each kind */
+#define RMW_LOOPS (1000)
+
+/**
+ * @brief Clears the callback counters
+ */
+static void rmw_clear() {
+    mem_stats.rd_cb_calls.store(0);
+    mem_stats.wr_cb_calls.store(0);
+    GPIO_in_hook.clear();
+    RTC_rd_hook.clear();
+    RTC_set_hook.clear();
+}
+
+/**
+ * @brief Callback calls since the last rmw_clear()
+ */
+static uint64_t rmw_calls() {
+    return mem_stats.rd_cb_calls.load() + mem_stats.wr_cb_calls.load();
+}
+
+int main() {
+    /* RTC_CNT has both a read and a write callback */
+    memory[ADDR_RTC_CNT] = 0;
+    rmw_clear();
+
+    memory[ADDR_RTC_CNT] |= 0x5;
+    CHECK_EQ(RTC_set_hook.old_val.load(), 0x0);
+    CHECK_EQ(RTC_set_hook.new_val.load(), 0x5);
+    memory[ADDR_RTC_CNT] ^= 0x6;
+    CHECK_EQ(RTC_set_hook.old_val.load(), 0x5);
+    CHECK_EQ(RTC_set_hook.new_val.load(), 0x3);
+    memory[ADDR_RTC_CNT] &= ~0x1U;
+    CHECK_EQ(RTC_set_hook.old_val.load(), 0x3);
+    CHECK_EQ(RTC_set_hook.new_val.load(), 0x2);
+    CHECK_EQ(memory.peek(ADDR_RTC_CNT), 0x2);
+    rmw_clear();
+
+    /* Before: the operators read the register through its read callback, then wrote it */
+    for (int i = 0; i < RMW_LOOPS; i++) {
+        memory[ADDR_RTC_CNT] = memory[ADDR_RTC_CNT] | 0x10;
+        memory[ADDR_RTC_CNT] = memory[ADDR_RTC_CNT] ^ 0x20;
+        memory[ADDR_RTC_CNT] = memory[ADDR_RTC_CNT] & ~0x10U;
+    }
+    uint64_t before = rmw_calls();
+    CHECK_EQ(mem_stats.rd_cb_calls.load(), 3 * RMW_LOOPS);
+    CHECK_EQ(mem_stats.wr_cb_calls.load(), 3 * RMW_LOOPS);
+    CHECK_EQ(memory.peek(ADDR_RTC_CNT), 0x2);
+    rmw_clear();
+
+    /* Now: one write callback per operation */
+    for (int i = 0; i < RMW_LOOPS; i++) {
+        memory[ADDR_RTC_CNT] |= 0x10;
+        memory[ADDR_RTC_CNT] ^= 0x20;
+        memory[ADDR_RTC_CNT] &= ~0x10U;
+    }
+    CHECK_EQ(mem_stats.rd_cb_calls.load(), 0);
+    CHECK_EQ(mem_stats.wr_cb_calls.load(), 3 * RMW_LOOPS);
+    CHECK_EQ(RTC_rd_hook.calls.load(), 0);
+    CHECK_EQ(RTC_set_hook.calls.load(), 3 * RMW_LOOPS);
+    CHECK_EQ(2 * rmw_calls(), before);
+    CHECK_EQ(memory.peek(ADDR_RTC_CNT), 0x2);
+    rmw_clear();
+
+    /* Plain accesses keep one callback each */
+    (void) (uint32_t) memory[ADDR_RTC_CNT];
+    memory[ADDR_RTC_CNT] = 0;
+    CHECK_EQ(mem_stats.rd_cb_calls.load(), 1);
+    CHECK_EQ(mem_stats.wr_cb_calls.load(), 1);
+    rmw_clear();
+
+    /* HAL GPIO calls: PORTx_OUT, PORTx_INT and PORTx_CTRL have no callback, each call is one atomic RMW */
+    for (int i = 0; i < RMW_LOOPS; i++) {
+        CHECK(GPIO_PinSet(PORTA, 3));
+        CHECK(GPIO_PinToggle(PORTA, 5));
+        CHECK(GPIO_PinClear(PORTA, 3));
+        CHECK(GPIO_IntEnable(PORTA, 2));
+        CHECK(GPIO_IntDisable(PORTA, 2));
+    }
+    CHECK_EQ(rmw_calls(), 0);
+    CHECK_EQ(memory.peek(ADDR_PORTA_OUT), 0x0);
+    CHECK_EQ(memory.peek(ADDR_PORTA_INT), 0x0);
+
+    /* GPIO inputs: the pin changes made by the GUI inputs, one GPIO_in_cb call each with the edge */
+    for (int i = 0; i < RMW_LOOPS; i++) {
+        memory[ADDR_PORTB_IN].hw_fetch_or(1U << 1);
+        CHECK_EQ(GPIO_in_hook.old_val.load(), 0x0);
+        CHECK_EQ(GPIO_in_hook.new_val.load(), 0x2);
+        memory[ADDR_PORTB_IN].hw_fetch_and(~(1U << 1));
+        CHECK_EQ(GPIO_in_hook.old_val.load(), 0x2);
+        CHECK_EQ(GPIO_in_hook.new_val.load(), 0x0);
+    }
+    CHECK_EQ(mem_stats.rd_cb_calls.load(), 0);
+    CHECK_EQ(mem_stats.wr_cb_calls.load(), 2 * RMW_LOOPS);
+    CHECK_EQ(GPIO_in_hook.calls.load(), 2 * RMW_LOOPS);
+    rmw_clear();
+
+    /* PORTx_IN is read-only to the firmware: its RMW changes nothing, still one callback call */
+    memory[ADDR_PORTB_IN].hw_fetch_or(1U << 4);
+    rmw_clear();
+    for (int i = 0; i < RMW_LOOPS; i++) {
+        memory[ADDR_PORTB_IN] |= 0x1;
+        memory[ADDR_PORTB_IN] ^= 0x10;
+        memory[ADDR_PORTB_IN] &= ~0x10U;
+    }
+    CHECK_EQ(mem_stats.rd_cb_calls.load(), 0);
+    CHECK_EQ(mem_stats.wr_cb_calls.load(), 3 * RMW_LOOPS);
+    CHECK_EQ(GPIO_in_hook.calls.load(), 3 * RMW_LOOPS);
+    CHECK_EQ(GPIO_in_hook.old_val.load(), 0x10);
+    CHECK_EQ(GPIO_in_hook.new_val.load(), 0x10);
+    CHECK_EQ(memory.peek(ADDR_PORTB_IN), 0x10);
+
+    printf("%d read-modify-writes: one write callback each, %llu callback calls before\n", 3 * RMW_LOOPS,
+           (unsigned long long) before);
+    return 0;
+}